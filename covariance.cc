@@ -0,0 +1,234 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Covariance of returns: dense, factor model, running and rolling moments
+ */
+#include <assert.h>
+#include <math.h>   /* sqrt */
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues> /* SelfAdjointEigenSolver */
+
+#include "util.h"
+#include "covariance.h"
+
+using namespace std;
+using namespace Eigen;
+
+/* tiles of COV_TILE columns; a tile of C is one COV_TILE x COV_TILE GEMM */
+#define COV_TILE 64
+
+MatrixXd cov(MatrixXd const & m)
+{
+	/* please see https://stats.stackexchange.com/a/100948
+	 * here, each column of 'm' is a variable, for which each
+	 * row represents an observation.
+	 * the covariance matrix will be of dimension k-by-k
+	 * where k = ncol(m)
+	 *
+	 * C = X^T X / (nrow - 1), where X is 'm' with each column centered on its mean.
+	 * X is built once, and C is computed one tile at a time: the tile at
+	 * block row I, block column J is X(:, I)^T X(:, J), a small GEMM that Eigen
+	 * runs near peak. C is symmetrical, so only the tiles on or below the
+	 * diagonal are computed (a symmetric rank-k update), in parallel, and then
+	 * copied to the upper right half.
+	 */
+	assert(m.rows() > 1 && "Rows must be greater than 1 for cov function");
+
+	MatrixXd C;
+	MatrixXd X;
+	int nrow, ncol, ntile, k;
+
+	nrow = m.rows();
+	ncol = m.cols();
+	X = m.rowwise() - m.colwise().mean();
+	C.resize(ncol, ncol);
+	ntile = (ncol + COV_TILE - 1) / COV_TILE;
+
+#pragma omp parallel for schedule(dynamic)
+	for (int t = 0; t < ntile * (ntile + 1) / 2; t++) {
+		/* t enumerates the tiles (I, J) with J <= I, row by row */
+		int I = 0;
+		while ((I + 1) * (I + 2) / 2 <= t)
+			I++;
+		int J = t - I * (I + 1) / 2;
+		int i0 = I * COV_TILE, ni = MIN(COV_TILE, ncol - i0);
+		int j0 = J * COV_TILE, nj = MIN(COV_TILE, ncol - j0);
+		C.block(i0, j0, ni, nj).noalias() = X.middleCols(i0, ni).transpose() * X.middleCols(j0, nj);
+	}
+	C /= (double) (nrow - 1);
+
+	/* copy the lower left half to the upper right half */
+	for (k = 0; k < ncol; k++) {
+		C.row(k).tail(ncol - k - 1) = C.col(k).tail(ncol - k - 1).transpose();
+	}
+	return C;
+}
+
+/*
+ * the statistical factor model of the returns 'm' (one column per security):
+ * B holds the first 'nfactors' principal components of cov(m), scaled by the
+ * square root of their eigenvalues, and D the variance of each security that
+ * they leave unexplained. The principal components come from the eigenvectors
+ * of whichever of X^T X (k x k) and X X^T (T x T) is smaller, X being 'm' with
+ * centered columns, so that cov(m) is never formed when k > T.
+ */
+void factor_cov(MatrixXd const & m, int nfactors, cov_model *cv)
+{
+	int nrow = m.rows();
+	int ncol = m.cols();
+	MatrixXd X = m.rowwise() - m.colwise().mean();
+	int f = MIN(nfactors, MIN(nrow - 1, ncol));
+
+	cv->factors = f;
+	cv->C.resize(0, 0);
+	if (ncol <= nrow) {
+		SelfAdjointEigenSolver<MatrixXd> eig(X.transpose() * X / (double) (nrow - 1));
+		/* eigenvalues are in increasing order */
+		cv->B = eig.eigenvectors().rightCols(f) *
+		        eig.eigenvalues().tail(f).cwiseMax(0.0).cwiseSqrt().asDiagonal();
+	} else {
+		/* if X = U S V^T, X X^T = U S^2 U^T and the loadings V S / sqrt(T - 1) = X^T U / sqrt(T - 1) */
+		SelfAdjointEigenSolver<MatrixXd> eig(X * X.transpose());
+		cv->B = X.transpose() * eig.eigenvectors().rightCols(f) / sqrt((double) (nrow - 1));
+	}
+	cv->D = (X.colwise().squaredNorm().transpose() / (double) (nrow - 1)
+	         - cv->B.rowwise().squaredNorm()).cwiseMax(0.0);
+}
+
+/* w^T C w, C being the covariance of the first w.size() securities in 'cv' */
+double cov_quad(cov_model const & cv, Ref<VectorXd const> w)
+{
+	int m = w.size();
+	if (cv.factors == 0) {
+		return w.dot(cv.C.topLeftCorner(m, m) * w);
+	}
+	return (cv.B.topRows(m).transpose() * w).squaredNorm() + w.cwiseAbs2().dot(cv.D.head(m));
+}
+
+/* set 'm' to the moments of all the rows of R at once */
+void moments_init(moments *m, MatrixXd const & R)
+{
+	m->n = R.rows();
+	m->mean = R.colwise().mean();
+	m->M2 = cov(R) * (double) (m->n - 1);
+}
+
+/* add one row of returns to 'm' (Welford's update) */
+void moments_add(moments *m, VectorXd const & r)
+{
+	VectorXd delta = r - m->mean;
+	m->n++;
+	m->mean += delta / (double) m->n;
+	m->M2.noalias() += ((double) (m->n - 1) / m->n) * delta * delta.transpose();
+}
+
+MatrixXd moments_cov(moments const & m)
+{
+	return m.M2 / (double) (m.n - 1);
+}
+
+/* returns 0 on success, -1 on error */
+int moments_save(char const *path, moments const & m)
+{
+	string tmp = string(path) + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	uint32_t k = m.tickers.size();
+
+	if (!file)
+		return -1;
+	fwrite(MOMENTS_MAGIC, 8, 1, file);
+	fwrite(&k, sizeof k, 1, file);
+	fwrite(&m.first, sizeof m.first, 1, file);
+	fwrite(&m.last, sizeof m.last, 1, file);
+	fwrite(&m.n, sizeof m.n, 1, file);
+	for (auto const & t : m.tickers) {
+		fwrite(t.c_str(), t.size() + 1, 1, file);
+	}
+	fwrite(m.mean.data(), sizeof(double), k, file);
+	fwrite(m.M2.data(), sizeof(double), (size_t) k * k, file);
+	int failed = ferror(file);
+	if (fclose(file) != 0 || failed) {
+		remove(tmp.c_str());
+		return -1;
+	}
+	return rename(tmp.c_str(), path);
+}
+
+/* returns 0 on success, -1 if the file does not exist or is not a moments file */
+int moments_load(char const *path, moments *m)
+{
+	char magic[8];
+	uint32_t k;
+	FILE *file = fopen(path, "rb");
+
+	if (!file)
+		return -1;
+	if (fread(magic, 8, 1, file) != 1 || memcmp(magic, MOMENTS_MAGIC, 8) != 0 ||
+	    fread(&k, sizeof k, 1, file) != 1 ||
+	    fread(&m->first, sizeof m->first, 1, file) != 1 ||
+	    fread(&m->last, sizeof m->last, 1, file) != 1 ||
+	    fread(&m->n, sizeof m->n, 1, file) != 1) {
+		fclose(file);
+		return -1;
+	}
+	m->tickers.clear();
+	for (uint32_t i = 0; i < k; i++) {
+		string t;
+		int c;
+		while ((c = fgetc(file)) > 0)
+			t.push_back(c);
+		m->tickers.push_back(t);
+	}
+	m->mean.resize(k);
+	m->M2.resize(k, k);
+	size_t nread = fread(m->mean.data(), sizeof(double), k, file);
+	nread += fread(m->M2.data(), sizeof(double), (size_t) k * k, file);
+	fclose(file);
+	return nread == k + (size_t) k * k ? 0 : -1;
+}
+
+
+/* remove one row of returns from 'm' (Welford's update, in reverse) */
+void moments_remove(moments *m, VectorXd const & r)
+{
+	VectorXd delta = r - m->mean;
+	m->n--;
+	m->mean -= delta / (double) m->n;
+	m->M2.noalias() -= ((double) (m->n + 1) / m->n) * delta * delta.transpose();
+}
+
+void rolling_init(rolling_cov *rc, MatrixXd const & R, int window)
+{
+	rc->start = 0;
+	rc->window = window;
+	rc->nslides = 0;
+	moments_init(&rc->m, R.topRows(window));
+}
+
+/* move the window down one row. returns 0, or -1 if it is already at the bottom of R */
+int rolling_slide(rolling_cov *rc, MatrixXd const & R)
+{
+	if (rc->start + rc->window >= R.rows())
+		return -1;
+	rc->start++;
+	if (++rc->nslides == ROLLING_REFRESH) {
+		rc->nslides = 0;
+		moments_init(&rc->m, R.middleRows(rc->start, rc->window));
+		return 0;
+	}
+	moments_add(&rc->m, R.row(rc->start + rc->window - 1).transpose());
+	moments_remove(&rc->m, R.row(rc->start - 1).transpose());
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Covariance of returns: dense, factor model, running and rolling moments
+ */
+#ifndef COVARIANCE_H
+#define COVARIANCE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+/* the covariance matrix of the columns of 'm', one observation per row */
+Eigen::MatrixXd cov(Eigen::MatrixXd const & m);
+
+/*
+ * A covariance matrix, either dense (factors == 0), in C, or the factor model
+ * B B^T + diag(D) of factor_cov(), where B is k x factors. The factor model takes
+ * O(k * factors) memory, and w^T (B B^T + diag(D)) w = |B^T w|^2 + sum(D w^2)
+ * takes O(k * factors) time, where the dense matrix needs O(k^2) of both.
+ */
+struct cov_model {
+	int factors;
+	Eigen::MatrixXd C;
+	Eigen::MatrixXd B;
+	Eigen::VectorXd D;
+};
+
+/*
+ * Running moments of the rows of a returns matrix, so that the mean returns and
+ * the covariance matrix can be brought up to date one new row (week) at a time,
+ * in O(k^2), instead of being recomputed from the full history.
+ *   n    = number of rows seen
+ *   mean = mean of each column
+ *   M2   = sum over the rows r of (r - mean)(r - mean)^T, so cov(R) = M2 / (n - 1)
+ * 'first' is the date of the first price the returns were computed from, and
+ * 'last' the date of the last price of the last row added (see parse_date).
+ * The weekly blocks are anchored at 'first', so a state can only be extended
+ * by data with the same tickers and the same start date.
+ */
+#define MOMENTS_MAGIC "PXMOMNT1"
+
+struct moments {
+	std::vector<std::string> tickers;
+	int32_t first;
+	int32_t last;
+	long n;
+	Eigen::VectorXd mean;
+	Eigen::MatrixXd M2;
+};
+
+/*
+ * Means and covariance of a window of 'window' consecutive rows of R that
+ * slides down one row at a time. Each slide adds the newest row and removes
+ * the oldest in O(k^2). Removing rows lets rounding error build up, so every
+ * ROLLING_REFRESH slides the moments are recomputed from the window itself.
+ */
+#define ROLLING_REFRESH 64
+
+struct rolling_cov {
+	moments m;
+	int start;     /* the window is rows [start, start + window) of R */
+	int window;
+	int nslides;   /* slides since the last recompute */
+};
+
+/* the factor model of 'nfactors' principal components of the returns 'm' */
+void factor_cov(Eigen::MatrixXd const & m, int nfactors, cov_model *cv);
+/* w^T C w, C being the covariance of the first w.size() securities in 'cv' */
+double cov_quad(cov_model const & cv, Eigen::Ref<Eigen::VectorXd const> w);
+
+void moments_init(moments *m, Eigen::MatrixXd const & R);
+void moments_add(moments *m, Eigen::VectorXd const & r);
+void moments_remove(moments *m, Eigen::VectorXd const & r);
+Eigen::MatrixXd moments_cov(moments const & m);
+/* returns 0 on success, -1 on error */
+int moments_save(char const *path, moments const & m);
+/* returns 0 on success, -1 if the file does not exist or is not a moments file */
+int moments_load(char const *path, moments *m);
+
+/* the window of the first 'window' rows of R */
+void rolling_init(rolling_cov *rc, Eigen::MatrixXd const & R, int window);
+/* move the window down one row. returns 0, or -1 if it is already at the bottom of R */
+int rolling_slide(rolling_cov *rc, Eigen::MatrixXd const & R);
+
+#endif
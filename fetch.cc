@@ -0,0 +1,795 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Downloading stock data from Quandl into a database directory of CSV files
+ */
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>    /* strcasecmp */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getpid */
+
+#include <algorithm>    /* sort, stable_sort, unique */
+#include <queue>        /* priority_queue */
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>    /* opendir, readdir */
+#include <inttypes.h>  /* PRIx64, SCNx64 */
+#include <sys/stat.h>  /* see stat(2), mkdir(2) */
+#include <sys/types.h>
+
+#include <curl/curl.h>
+
+#include "pricestore.h"
+#include "util.h"
+#include "fetch.h"
+
+using namespace std;
+
+#define RETRY_BASE 1.0        /* seconds, doubled for each retry */
+
+int database_init(char const *path)
+{
+	struct stat buf;      /* $ man 2 stat */
+	int status;
+
+	errno = 0;
+	memset(&buf, 0, sizeof buf);
+	status = mkdir(path, 0755); /* 0755 = drwxr-xr-x */
+	if (status == -1) {
+		if (errno == EEXIST) {    /* 'path' already exists. Is it a directory? */
+			if ((stat(path, &buf) == 0) && S_ISDIR(buf.st_mode))
+				return 0;
+		}
+	}
+	return status;
+}
+
+/*
+ * make_url("https://.../WIKI/", "TICKER","api_token", "begin", "end")
+ * will form a proper URL for communicating with the Quandl API
+ * begin and end dates are optional (use NULL or nullptr to omit)
+ */
+string make_url(string const & urlbase,
+                     string const & ticker,
+                     string const & token,
+                     char const *begin,
+                     char const *end)
+{
+	auto url = urlbase + ticker + ".csv?order=asc&api_key=" + token;
+	if (begin) {
+		url.append("&start_date=");
+		url.append(begin);
+	}
+	if (end) {
+		url.append("&end_date=");
+		url.append(end);
+	}
+	return url;
+}
+
+/*
+ * make_filename("/path/to/dir","TICKER","begin","end") = "/path/to/dir/TICKER.begin.end.csv"
+ * where:
+ *   begin, end are of the form YYYY-mm-dd
+ */
+string make_filename(string const & dbroot, string const & ticker,
+                          char const *begin, char const *end)
+{
+	stringstream fname;
+	fname << dbroot;
+	if (dbroot.back() != '/') {
+		fname << '/';
+	}
+	fname << ticker;
+	if (begin && end) {
+		fname << '.' << begin << '.' << end;
+	}
+	fname << ".csv";
+	return fname.str();
+}
+
+/*
+ * the dates of _filename, of the form "TICKER.begin.end.csv" (see make_filename).
+ * returns 0 if its name has no dates
+ */
+int file_dates(string const & _filename, string *begin, string *end)
+{
+	char const *filename;
+	char const *begin_date, *end_date, *ext;
+	int32_t day;
+
+	filename = _filename.c_str();
+	char const *last_slash = strrchr(filename, '/');
+	if (last_slash != NULL)
+		filename = last_slash + 1;
+
+	begin_date = strchr(filename, '.');
+	if (begin_date == NULL)
+		return 0;
+	begin_date++;
+
+	end_date = parse_date(begin_date, &day);
+	if (end_date == NULL || *end_date != '.')
+		return 0;
+	end_date++;
+	ext = parse_date(end_date, &day);
+	if (ext == NULL)
+		return 0;
+	begin->assign(begin_date, end_date - 1);
+	end->assign(end_date, ext);
+	return 1;
+}
+
+/* the modification time of a file, in nanoseconds: a file rewritten within the
+ * second it was catalogued in must still look changed */
+static long long mtime_ns(struct stat const & st)
+{
+	return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+/*
+ * count the data rows of the file 'path' and hash it, into *e, with its size and mtime.
+ * returns -1 if it cannot be read
+ */
+int catalog_scan(string const & path, catalog_entry *e)
+{
+	char buf[1 << 16];
+	size_t n;
+	uint64_t hash = 14695981039346656037ULL;   /* FNV-1a offset basis */
+	long lines = 0;
+	char last = '\n';
+	struct stat st;
+
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file)
+		return -1;
+	if (fstat(fileno(file), &st) == -1) {
+		fclose(file);
+		return -1;
+	}
+	while ((n = fread(buf, 1, sizeof buf, file)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			hash = (hash ^ (unsigned char) buf[i]) * 1099511628211ULL;
+			lines += buf[i] == '\n';
+		}
+		last = buf[n - 1];
+	}
+	fclose(file);
+	if (last != '\n')   /* the last line has no '\n' */
+		lines++;
+	e->rows = (lines > 0) ? lines - 1 : 0;   /* not counting the header */
+	e->checksum = hash;
+	e->size = st.st_size;
+	e->mtime = mtime_ns(st);
+	return 0;
+}
+
+/* (re)catalog the file 'path' as the data of 'ticker'. returns -1 if it has no dates or no data */
+int catalog_add(catalog *cat, string const & ticker, string const & path)
+{
+	catalog_entry e;
+	char const *base = strrchr(path.c_str(), '/');
+	e.file = base ? base + 1 : path;
+	if (!file_dates(e.file, &e.begin, &e.end) || catalog_scan(path, &e) == -1)
+		return -1;
+	if (e.rows == 0)   /* nothing to reuse */
+		return -1;
+	(*cat)[ticker] = e;
+	return 0;
+}
+
+/*
+ * catalog the TICKER.begin.end.csv files of 'dbroot', for a directory that has no
+ * catalog yet. a ticker with more than one file gets the one with the most rows
+ */
+void catalog_build(catalog *cat, string const & dbroot)
+{
+	DIR *dir = opendir(dbroot.c_str());
+	if (!dir)
+		return;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		char const *name = ent->d_name;
+		size_t len = strlen(name);
+		if (len <= 4 || strcasecmp(name + len - 4, ".csv") != 0)
+			continue;
+		catalog one;
+		string ticker = upper(string(name, strchrnul(name, '.')).c_str());
+		if (catalog_add(&one, ticker, dbroot + "/" + name) == -1)
+			continue;
+		auto old = cat->find(ticker);
+		if (old == cat->end() || old->second.rows < one[ticker].rows)
+			(*cat)[ticker] = one[ticker];
+	}
+	closedir(dir);
+}
+
+/* write the catalog of 'dbroot', sorted by ticker. returns -1 on failure */
+int catalog_save(catalog const & cat, string const & dbroot)
+{
+	string path = dbroot + "/" CATALOG_NAME;
+	string tmp = path + ".tmp";
+	vector<string> tickers;
+
+	for (auto const & kv : cat)
+		tickers.push_back(kv.first);
+	sort(tickers.begin(), tickers.end());
+	FILE *file = fopen(tmp.c_str(), "w");
+	if (!file)
+		return -1;
+	for (auto const & t : tickers) {
+		catalog_entry const & e = cat.at(t);
+		fprintf(file, "%s\t%s\t%s\t%s\t%ld\t%016" PRIx64 "\t%lld\t%lld\n", t.c_str(), e.file.c_str(),
+		        e.begin.c_str(), e.end.c_str(), e.rows, e.checksum, e.size, e.mtime);
+	}
+	if (fclose(file) != 0 || rename(tmp.c_str(), path.c_str()) == -1) {
+		remove(tmp.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+/* read the catalog of 'dbroot', building it from the directory if there is none */
+void catalog_load(catalog *cat, string const & dbroot)
+{
+	string path = dbroot + "/" CATALOG_NAME;
+	char line[1024];
+	char ticker[256], file[512], begin[64], end[64];
+
+	FILE *in = fopen(path.c_str(), "r");
+	if (!in) {
+		catalog_build(cat, dbroot);
+		if (catalog_save(*cat, dbroot) == -1)
+			warn("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+		return;
+	}
+	while (fgets(line, sizeof line, in)) {
+		catalog_entry e;
+		e.size = -1;   /* a line without SIZE and MTIME: hash the file before trusting it */
+		e.mtime = 0;
+		int n = sscanf(line, "%255s %511s %63s %63s %ld %" SCNx64 " %lld %lld", ticker, file,
+		               begin, end, &e.rows, &e.checksum, &e.size, &e.mtime);
+		if (n != 6 && n != 8) {
+			warn("Bad line in %s: %s", path.c_str(), line);
+			continue;
+		}
+		e.file = file;
+		e.begin = begin;
+		e.end = end;
+		(*cat)[ticker] = e;
+	}
+	fclose(in);
+}
+
+/*
+ * the catalog entry of 'ticker', or NULL if it has none, or its file is gone or has changed.
+ * a file with the size and mtime of its entry is taken as unchanged; any other is hashed
+ * again, and is unchanged if the checksum still matches (then its entry takes the new mtime)
+ */
+catalog_entry *catalog_find(catalog *cat, string const & dbroot, string const & ticker)
+{
+	struct stat buf;
+
+	auto it = cat->find(ticker);
+	if (it == cat->end())
+		return NULL;
+	catalog_entry *e = &it->second;
+	string path = dbroot + "/" + e->file;
+	if (stat(path.c_str(), &buf) == -1) {
+		cat->erase(it);
+		return NULL;
+	}
+	if (buf.st_size == e->size && mtime_ns(buf) == e->mtime)
+		return e;
+	catalog_entry now;
+	if (catalog_scan(path, &now) == -1 || now.checksum != e->checksum) {
+		warn("%s has changed since it was catalogued, downloading it again\n", path.c_str());
+		cat->erase(it);
+		return NULL;
+	}
+	e->size = now.size;
+	e->mtime = now.mtime;
+	return e;
+}
+
+/* check if the catalogued file includes the dates specified */
+int has_data(catalog_entry const & e, char const *a_begin, char const *a_end)
+{
+	int32_t argbegin, argend, begin, end;
+
+	if (!parse_date(a_begin, &argbegin) || !parse_date(a_end, &argend) ||
+	    !parse_date(e.begin.c_str(), &begin) || !parse_date(e.end.c_str(), &end))
+		return 0;
+	return begin <= argbegin && end >= argend;
+}
+
+/*
+ * Curl Callback to write directly to a file.
+ * a short write (a full disk) returns less than was given, and curl fails the
+ * transfer with CURLE_WRITE_ERROR
+ */
+size_t curl_callback_fwrite(void *buf, size_t size, size_t nmemb, void *file)
+{
+	return fwrite(buf, 1, size * nmemb, (FILE *)file);
+}
+
+/*
+ * Curl Callback to keep the data in memory
+ */
+size_t curl_callback_append(void *buf, size_t size, size_t nmemb, void *body)
+{
+	((string *) body)->append((char const *) buf, size * nmemb);
+	return size * nmemb;
+}
+
+/*
+ * Curl Callback to parse the data as it arrives, see csv_feed()
+ */
+size_t curl_callback_parse(void *buf, size_t size, size_t nmemb, void *parser)
+{
+	csv_feed((csv_parser *) parser, (char const *) buf, size * nmemb);
+	return size * nmemb;
+}
+
+/* one transfer: the whole of a job's data, or one of its deltas */
+struct transfer {
+	fetch *job;
+	int delta;               /* index into job->deltas, or -1 */
+	int attempts;            /* retries so far */
+};
+
+/* parse a cached CSV file as if it had just been downloaded */
+void parse_file(char const *path, csv_parser *p, store_series *s)
+{
+	if (csv_read_file(path, p, s) == -1)
+		warn("Failed to open %s: %s\n", path, strerror(errno));
+}
+
+/* a data row of a CSV file, and its date */
+struct csv_row {
+	int32_t day;
+	char const *line;
+	size_t len;
+	int cached;   /* 1 if the row is from the cached file, 0 if it was downloaded */
+};
+
+/*
+ * the lines of 'text' (without their '\n'), in *lines.
+ * a '\r' before the '\n' is kept, except on the first line (the header)
+ */
+void split_lines(string const & text, vector<pair<char const *, size_t> > *lines)
+{
+	char const *s = text.data();
+	char const *end = s + text.size();
+	while (s < end) {
+		char const *nl = (char const *) memchr(s, '\n', end - s);
+		char const *e = nl ? nl : end;
+		size_t len = e - s;
+		if (lines->empty() && len > 0 && s[len - 1] == '\r')
+			len--;
+		lines->emplace_back(s, len);
+		s = nl ? nl + 1 : end;
+	}
+}
+
+/*
+ * write the rows of the CSV file 'cached' and of the downloads 'bodies' to 'path',
+ * sorted by date. a date that is in more than one of them is written once. every
+ * body must have the cached file's header.
+ * returns 0 on success, -1 if they could not be merged (a warning has been printed),
+ * or 1, and nothing is written, if a body has a row for a date of the cached file
+ * that differs from the cached row: the prices have been restated since the file
+ * was downloaded (a split or a dividend adjusts every earlier price).
+ */
+int merge_csv(string const & cached, vector<string> const & bodies, string const & path)
+{
+	string old = slurp(cached);
+	vector<pair<char const *, size_t> > header, lines;
+	vector<csv_row> rows;
+
+	split_lines(old, &header);
+	if (header.empty()) {
+		warn("%s is empty\n", cached.c_str());
+		return -1;
+	}
+	char const *h = header[0].first;
+	size_t hlen = header[0].second;
+	int date_index = csv_column(h, h + hlen, "Date");
+	if (date_index == -1) {
+		warn("Could not find the date field in %s\n", cached.c_str());
+		return -1;
+	}
+	for (size_t k = 0; k <= bodies.size(); k++) {
+		lines.clear();
+		split_lines(k == 0 ? old : bodies[k - 1], &lines);
+		if (lines.empty() || lines[0].second != hlen || memcmp(lines[0].first, h, hlen) != 0) {
+			warn("Downloaded data for %s does not match its header\n", cached.c_str());
+			return -1;
+		}
+		for (size_t i = 1; i < lines.size(); i++) {
+			char const *s = lines[i].first;
+			char const *e = s + lines[i].second;
+			char const *d = csv_field(s, e, date_index);
+			csv_row row;
+			if (!d || e - d < 10 || !parse_date(d, &row.day))
+				continue;
+			row.line = s;
+			row.len = lines[i].second;
+			row.cached = (k == 0);
+			rows.push_back(row);
+		}
+	}
+	stable_sort(rows.begin(), rows.end(), [](csv_row const & a, csv_row const & b) {
+		return a.day < b.day;
+	});
+	/* stable: on a date in both, the cached row comes first */
+	for (size_t i = 1; i < rows.size(); i++) {
+		csv_row const & a = rows[i - 1], & b = rows[i];
+		if (a.day == b.day && a.cached && !b.cached &&
+		    (a.len != b.len || memcmp(a.line, b.line, a.len) != 0))
+			return 1;
+	}
+	rows.erase(unique(rows.begin(), rows.end(), [](csv_row const & a, csv_row const & b) {
+		return a.day == b.day;
+	}), rows.end());
+
+	string tmp = path + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "w");
+	if (!file) {
+		warn("Failed to open %s: %s\n", tmp.c_str(), strerror(errno));
+		return -1;
+	}
+	fwrite(h, 1, hlen, file);
+	fputc('\n', file);
+	for (auto const & row : rows) {
+		fwrite(row.line, 1, row.len, file);
+		fputc('\n', file);
+	}
+	if (fclose(file) != 0 || rename(tmp.c_str(), path.c_str()) == -1) {
+		warn("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+		remove(tmp.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * all of the transfers of a job with a cached file have finished: merge its deltas
+ * into the file, or keep the whole download that replaced them.
+ * returns 1 if the deltas restate the cached rows (see merge_csv): the job is then
+ * set to download all of its dates again, into its file, and must be run again
+ */
+int extend(fetch *job)
+{
+	int r = -1;
+	if (!job->failed)
+		r = job->deltas.empty() ? 0 : merge_csv(job->cached, job->bodies, job->filename);
+	if (r == 1) {
+		warn("Prices of %s differ from %s, downloading all of them again\n",
+		     job->ticker.c_str(), job->cached.c_str());
+		job->url = job->whole;
+		job->deltas.clear();
+		job->bodies.clear();
+		return 1;
+	}
+	if (r == -1) {
+		warn("Keeping %s as it is\n", job->cached.c_str());
+		job->filename = job->cached;
+		job->failed = 1;
+	} else if (job->filename != job->cached) {
+		remove(job->cached.c_str());
+	}
+	job->bodies.clear();
+	if (job->parse)
+		parse_file(job->filename.c_str(), &job->parser, &job->data);
+	return 0;
+}
+
+/* seconds on a monotonic clock */
+double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * is a transfer that finished with 'result' and HTTP status 'code' worth trying again?
+ * 429 (too many requests) and 5xx are the server's trouble, not the request's,
+ * and so are connections that failed or broke off
+ */
+int retryable(CURLcode result, long code)
+{
+	switch (result) {
+	case CURLE_OK:
+		return code == 429 || (code >= 500 && code <= 599);
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_GOT_NOTHING:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_PARTIAL_FILE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * download every fetch with the curl multi interface, at most 'maxconn' at a time.
+ * a finished transfer's easy handle is reused for the next one, so its connection
+ * to the server is too. if 'list' is not NULL, the filenames are written to it in the
+ * order of 'jobs' (which is what main expects), each as soon as it and every one
+ * before it are done.
+ *
+ * requests are started at most 'rate' a second on average (a token bucket holding
+ * a second's worth, 0 for no limit). a transfer that fails with 429, 5xx or a broken
+ * connection is tried again, up to 'retries' times, after a random delay of up to
+ * RETRY_BASE * 2^attempt seconds (or the server's Retry-After, if it is longer).
+ * a 429 also empties the bucket. files are written under a temporary name and
+ * renamed once complete, so a failed download never leaves a partial file.
+ */
+void download_all(vector<fetch> & jobs, int maxconn, double rate, int retries, FILE *list)
+{
+	CURLM *multi = curl_multi_init();
+	vector<CURL *> idle;
+	vector<transfer> xfers;
+	/* transfers waiting to start, by the time they may start (then in order) */
+	priority_queue<pair<double, size_t>, vector<pair<double, size_t> >,
+	               greater<pair<double, size_t> > > waiting;
+	size_t printed = 0;  /* jobs[0..printed) have been printed */
+	int running = 0;
+	double capacity = (rate > 1) ? rate : 1;
+	double tokens = capacity;
+	double last = now_seconds();
+
+	for (auto & job : jobs) {
+		if (job.done)
+			continue;
+		if (!job.url.empty())
+			xfers.push_back({&job, -1, 0});
+		for (size_t k = 0; k < job.deltas.size(); k++)
+			xfers.push_back({&job, (int) k, 0});
+		job.bodies.assign(job.deltas.size(), string());
+		job.failed = 0;
+		job.pending = (int) (!job.url.empty() + job.deltas.size());
+	}
+	for (size_t i = 0; i < xfers.size(); i++) {
+		waiting.push(make_pair(0.0, i));
+	}
+	/* room for the whole download of every job whose prices are restated (see extend),
+	 * so that the transfers under way are not moved */
+	xfers.reserve(xfers.size() + jobs.size());
+	/* the jitter has a stream of its own: srand48() would reset the caller's */
+	long seed = getpid() ^ (long) time(NULL);
+	unsigned short xsubi[3] = { 0x330E, (unsigned short) seed, (unsigned short) (seed >> 16) };
+	curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) maxconn);
+	for (int i = 0; i < maxconn; i++) {
+		CURL *curl = curl_easy_init();
+		/* ask for compressed responses, in any encoding this libcurl can decode */
+		curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+		/* give up on a stalled connection, so it can be retried */
+		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+		idle.push_back(curl);
+	}
+	for (;;) {
+		double now = now_seconds();
+		if (rate > 0) {
+			tokens = min(capacity, tokens + (now - last) * rate);
+		}
+		last = now;
+		while (!waiting.empty() && !idle.empty() && waiting.top().first <= now &&
+		       (rate <= 0 || tokens >= 1)) {
+			transfer & t = xfers[waiting.top().second];
+			waiting.pop();
+			fetch & job = *t.job;
+			CURL *curl = idle.back();
+			if (t.delta >= 0) {
+				job.bodies[t.delta].clear();
+				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_callback_append);
+				curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job.bodies[t.delta]);
+			} else if (job.parse && job.filename.empty()) {  /* no file to write */
+				job.data.dates.clear();
+				job.data.prices.clear();
+				csv_init(&job.parser, &job.data);
+				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_callback_parse);
+				curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job.parser);
+			} else {
+				string tmp = job.filename + ".tmp";
+				job.file = fopen(tmp.c_str(), "w");
+				if (!job.file) {
+					warn("Failed to open %s: %s\n", tmp.c_str(), strerror(errno));
+					job.failed = 1;
+					job.done = 1;
+					continue;
+				}
+				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_callback_fwrite);
+				curl_easy_setopt(curl, CURLOPT_WRITEDATA, job.file);
+			}
+			idle.pop_back();
+			curl_easy_setopt(curl, CURLOPT_URL, (t.delta >= 0) ? job.deltas[t.delta].c_str() : job.url.c_str());
+			curl_easy_setopt(curl, CURLOPT_PRIVATE, &t);
+			curl_multi_add_handle(multi, curl);
+			tokens -= 1;
+			running++;
+		}
+		for ( ; printed < jobs.size() && jobs[printed].done; printed++) {
+			fetch const & job = jobs[printed];
+			if (list && !(job.failed && job.cached.empty())) {  /* skip if there is no file */
+				fprintf(list, "%s\n", job.filename.c_str());
+				fflush(list);
+			}
+		}
+		if (printed == jobs.size())
+			break;
+
+		curl_multi_perform(multi, &running);
+		CURLMsg *msg;
+		int left;
+		while ((msg = curl_multi_info_read(multi, &left))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			CURL *curl = msg->easy_handle;
+			transfer *t;
+			long code = 0;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &t);
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+			fetch *job = t->job;
+			CURLcode result = msg->data.result;
+			int ok = result == CURLE_OK && code >= 200 && code <= 299;
+			int werr = 0;   /* the body arrived, but could not be written out */
+			if (t->delta < 0 && job->parse && job->filename.empty()) {
+				csv_finish(&job->parser);
+			} else if (t->delta < 0 && fclose(job->file) != 0 && ok) {
+				/* buffered data is only written by fclose: the file may be short */
+				warn("Failed to write %s.tmp: %s\n", job->filename.c_str(), strerror(errno));
+				ok = 0;
+				werr = 1;
+			}
+			if (!ok && retryable(result, code) && t->attempts < retries) {
+				/* full jitter: anywhere up to the doubled delay, so clients spread out */
+				double delay = erand48(xsubi) * RETRY_BASE * (1 << min(t->attempts, 10));
+				curl_off_t after = -1;
+				curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &after);
+				if (after > delay)
+					delay = (double) after;
+				if (code == 429)
+					tokens = 0;
+				t->attempts++;
+				warn("Retrying %s in %.1fs (%s)\n", job->ticker.c_str(), delay,
+				     (result != CURLE_OK) ? curl_easy_strerror(result) : (code == 429) ? "throttled" : "server error");
+				waiting.push(make_pair(now_seconds() + delay, (size_t) (t - xfers.data())));
+				curl_multi_remove_handle(multi, curl);
+				idle.push_back(curl);
+				continue;
+			}
+			if (!ok) {
+				if (werr) {
+					/* reported above */
+				} else if (result != CURLE_OK) {
+					warn("Failed to download %s: %s\n", job->ticker.c_str(), curl_easy_strerror(result));
+				} else {
+					warn("Failed to download %s: HTTP %ld\n", job->ticker.c_str(), code);
+				}
+				job->failed = 1;
+			}
+			if (t->delta >= 0) {
+				/* merged by extend() once they are all here */
+			} else if (job->parse && job->filename.empty()) {
+				if (job->failed)  /* a truncated series is no use */
+					job->data.dates.clear();
+			} else {
+				string tmp = job->filename + ".tmp";
+				if (job->failed || rename(tmp.c_str(), job->filename.c_str()) == -1) {
+					if (!job->failed)
+						warn("Failed to rename %s: %s\n", tmp.c_str(), strerror(errno));
+					remove(tmp.c_str());
+					job->failed = 1;
+				}
+			}
+			if (--job->pending == 0) {
+				if (!job->cached.empty() && extend(job) == 1) {
+					job->pending = 1;
+					xfers.push_back({job, -1, 0});
+					waiting.push(make_pair(now_seconds(), xfers.size() - 1));
+				} else {
+					job->done = 1;
+				}
+			}
+			curl_multi_remove_handle(multi, curl);
+			idle.push_back(curl);
+		}
+		if (running > 0 || !waiting.empty()) {
+			/* sleep until there is something to read, or until a waiting transfer may start */
+			int timeout = 1000;
+			if (!waiting.empty() && !idle.empty()) {
+				double wake = waiting.top().first;
+				if (rate > 0 && tokens < 1)
+					wake = max(wake, now_seconds() + (1 - tokens) / rate);
+				timeout = (int) min(1000.0, max(0.0, (wake - now_seconds()) * 1000) + 1);
+			}
+			curl_multi_poll(multi, NULL, 0, timeout, NULL);
+		}
+	}
+	for (CURL *curl : idle) {
+		curl_easy_cleanup(curl);
+	}
+	curl_multi_cleanup(multi);
+}
+
+fetch fetch_job(catalog *cat, string const & dbroot, string const & urlbase,
+                string const & api_key, string const & ticker,
+                string const & begin, string const & end, int parse)
+{
+	catalog_entry *cached = dbroot.empty() ? NULL : catalog_find(cat, dbroot, ticker);
+	int32_t day, cday;
+	fetch job;
+	job.ticker = ticker;
+	job.file = NULL;
+	job.done = 0;
+	job.failed = 0;
+	job.parse = parse;
+	job.data.ticker = ticker;
+	if (cached) {
+		char const *cbegin = cached->begin.c_str(), *cend = cached->end.c_str();
+		job.filename = dbroot + "/" + cached->file;
+		if (has_data(*cached, begin.c_str(), end.c_str())) {
+			if (parse)
+				parse_file(job.filename.c_str(), &job.parser, &job.data);
+			job.done = 1;
+			return job;
+		}
+		/*
+		 * download only the dates before and after the cached ones. the ranges
+		 * overlap the cached file by a day, for merge_csv() to check that its prices
+		 * have not been restated since; if they have, 'whole' is downloaded instead
+		 */
+		char const *nbegin = cbegin, *nend = cend;
+		if (parse_date(begin.c_str(), &day) && parse_date(cbegin, &cday) && day < cday) {
+			job.deltas.push_back(make_url(urlbase, ticker, api_key, begin.c_str(), cbegin));
+			nbegin = begin.c_str();
+		}
+		if (parse_date(end.c_str(), &day) && parse_date(cend, &cday) && day > cday) {
+			job.deltas.push_back(make_url(urlbase, ticker, api_key, cend, end.c_str()));
+			nend = end.c_str();
+		}
+		if (job.deltas.empty()) {  /* only if the dates do not parse */
+			job.done = 1;
+			return job;
+		}
+		job.cached = job.filename;
+		job.filename = make_filename(dbroot, ticker, nbegin, nend);
+		job.whole = make_url(urlbase, ticker, api_key, nbegin, nend);
+		return job;
+	} else if (!parse) {
+		job.filename = make_filename(dbroot, ticker, begin.c_str(), end.c_str());
+	}
+	job.url = make_url(urlbase, ticker, api_key, begin.c_str(), end.c_str());
+	return job;
+}
+
+void catalog_update(catalog *cat, vector<fetch> const & jobs)
+{
+	for (auto const & job : jobs) {
+		int wrote = !job.deltas.empty() || (!job.url.empty() && !job.filename.empty());
+		if (wrote && !job.failed)
+			catalog_add(cat, job.ticker, job.filename);
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Downloading stock data from Quandl into a database directory of CSV files
+ */
+#ifndef FETCH_H
+#define FETCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pricestore.h"
+
+/* index of the files in a database directory, see catalog_entry */
+#define CATALOG_NAME "catalog"
+
+/* create the database directory 'path', if it does not exist. returns -1 on failure */
+int database_init(char const *path);
+/* the URL of the CSV data of 'ticker' between 'begin' and 'end' (either may be NULL) */
+std::string make_url(std::string const & urlbase, std::string const & ticker,
+                     std::string const & token, char const *begin, char const *end);
+/* dbroot/TICKER.begin.end.csv, or dbroot/TICKER.csv without dates */
+std::string make_filename(std::string const & dbroot, std::string const & ticker,
+                          char const *begin, char const *end);
+/* the dates in the name of a TICKER.begin.end.csv file. returns 0 if it has none */
+int file_dates(std::string const & filename, std::string *begin, std::string *end);
+
+/*
+ * The catalog of a database directory, in the file CATALOG_NAME there: one line per ticker,
+ *   TICKER FILE BEGIN END ROWS CHECKSUM SIZE MTIME
+ * separated by tabs, where FILE is the name of the ticker's CSV file in the directory,
+ * BEGIN and END the dates it covers, ROWS its number of data rows, CHECKSUM the
+ * 64 bit FNV-1a hash of the file, in hex, and SIZE and MTIME its size and modification
+ * time when it was hashed. getstock updates it whenever it writes a file,
+ * so finding a ticker's data never lists the directory or parses file names.
+ * Catalogs written without SIZE and MTIME are still read; their files are hashed again.
+ */
+struct catalog_entry {
+	std::string file;
+	std::string begin;
+	std::string end;
+	long rows;
+	uint64_t checksum;
+	long long size;   /* -1 if not known */
+	long long mtime;  /* in nanoseconds */
+};
+
+typedef std::unordered_map<std::string, catalog_entry> catalog;
+
+int catalog_add(catalog *cat, std::string const & ticker, std::string const & path);
+void catalog_build(catalog *cat, std::string const & dbroot);
+/* write the catalog of 'dbroot'. returns -1 on failure */
+int catalog_save(catalog const & cat, std::string const & dbroot);
+/* read the catalog of 'dbroot', or build it if there is none */
+void catalog_load(catalog *cat, std::string const & dbroot);
+/* the catalogued file of 'ticker', or NULL if there is none or it has changed: a file
+ * whose size or mtime differs from its entry's is hashed again and compared with CHECKSUM */
+catalog_entry *catalog_find(catalog *cat, std::string const & dbroot, std::string const & ticker);
+/* does the catalogued file cover 'begin' to 'end'? */
+int has_data(catalog_entry const & e, char const *begin, char const *end);
+
+/*
+ * one ticker: its file, and the URL to download it from if it is not cached.
+ * with 'parse', the download goes to 'parser' (and 'data') instead of the file.
+ * a cached file that covers part of the dates is extended instead: only the
+ * ranges missing from it are downloaded (see merge_csv)
+ */
+struct fetch {
+	std::string ticker;
+	std::string filename;
+	std::string url;              /* empty if the file already has the data */
+	std::string cached;           /* the file that 'deltas' extend into 'filename' */
+	std::vector<std::string> deltas;   /* URLs of the date ranges missing from 'cached' */
+	std::vector<std::string> bodies;   /* what they returned */
+	std::string whole;            /* URL of all of filename's dates, if 'deltas' restate 'cached' */
+	FILE *file;
+	int done;
+	int failed;
+	int pending;             /* transfers not finished yet */
+	int parse;
+	store_series data;
+	csv_parser parser;
+};
+
+/*
+ * the job that brings 'ticker' up to date, from 'begin' to 'end': nothing to download
+ * if its file in the catalog has the data, the missing dates if it has part of them,
+ * all of them otherwise. 'dbroot' is "" (and 'cat' NULL) for no database
+ */
+fetch fetch_job(catalog *cat, std::string const & dbroot, std::string const & urlbase,
+                std::string const & api_key, std::string const & ticker,
+                std::string const & begin, std::string const & end, int parse);
+/* parse a cached CSV file as if it had just been downloaded */
+void parse_file(char const *path, csv_parser *p, store_series *s);
+/* merge 'bodies', CSV data of the same columns, into the file 'cached', as 'path'.
+ * returns 0, -1 on error, or 1 if the bodies restate the cached prices (nothing is written) */
+int merge_csv(std::string const & cached, std::vector<std::string> const & bodies, std::string const & path);
+/* download every job, writing the filenames to 'list' (if not NULL) as they are done.
+ * curl_global_init must have been called */
+void download_all(std::vector<fetch> & jobs, int maxconn, double rate, int retries, FILE *list);
+/* catalog the files that 'jobs' wrote: downloaded, or extended */
+void catalog_update(catalog *cat, std::vector<fetch> const & jobs);
+
+#endif
@@ -14,58 +14,26 @@
 #endif
 #include <ctype.h>
 #include <errno.h>
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>    /* strncasecmp */
 
-#include <algorithm>    /* rotate, find_if */
-#include <fstream>
-#include <iostream>
-#include <sstream>
+#include <algorithm>    /* rotate, find_if, sort, unique */
 #include <string>
 #include <vector>
 
-#include <sys/stat.h>  /* see stat(2), mkdir(2) */
-#include <sys/types.h>
-
 #include <curl/curl.h>
 
-using namespace std;
-
-/* date format used for file naming */
-#define DATE_FMT "%Y-%m-%d"
-
-static const string urlbase = "https://www.quandl.com/api/v3/datasets/WIKI/";
-
-int database_init(char const *path)
-{
-	struct stat buf;      /* $ man 2 stat */
-	int status;
+#include "pricestore.h"
+#include "util.h"
+#include "fetch.h"
 
-	errno = 0;
-	memset(&buf, 0, sizeof buf);
-	status = mkdir(path, 0755); /* 0755 = drwxr-xr-x */
-	if (status == -1) {
-		if (errno == EEXIST) {    /* 'path' already exists. Is it a directory? */
-			if ((stat(path, &buf) == 0) && S_ISDIR(buf.st_mode))
-				return 0;
-		}
-	}
-	return status;
-}
+using namespace std;
 
-string slurp(string filename)
-{
-	ifstream file{filename};
-	if (!file.is_open()) {
-		return {};
-	}
-	stringstream ss;
-	ss << file.rdbuf();
-	return ss.str();
-}
+#define DEFAULT_URLBASE "https://www.quandl.com/api/v3/datasets/WIKI/"
+#define DEFAULT_JOBS 4
+#define DEFAULT_RATE 3.0      /* requests a second, under Quandl's limit of 2000 per 10 minutes */
+#define DEFAULT_RETRIES 5
 
 void lstrip(string *s) /* left-hand side strip */
 {
@@ -93,209 +61,79 @@ void strip(string *s)
 	rstrip(s);
 }
 
-void lstrip(char *s)
-{
-	char *begin;
-	for (begin = s; *begin != '\0' && isspace(*begin); begin++)
-		;
-	if (*begin != '\0') {
-		memmove(s, begin, strlen(begin) + 1);
-	} else {
-		*s = '\0';
-	}
-}
-
-void rstrip(char *s)
-{
-	char *end;
-	for (end = s + strlen(s) - 1; end >= s && isspace(*end); end--)
-		;
-	end++;
-	*end = '\0';
-}
-
-void strip(char *s)
-{
-	lstrip(s);
-	rstrip(s);
-}
-
-
-string upper(char const *s)
-{
-	int size = (int) strlen(s);
-	string ret;
-	ret.resize(size);
-	for (int i = 0; i < size; i++) {
-		ret[i] = toupper(s[i]);
-	}
-	return ret;
-}
-
 /*
- * make_url("TICKER","api_token", "begin", "end")
- * will form a proper URL for communicating with the Quandl API
- * begin and end dates are optional (use NULL or nullptr to omit)
+ * write the parsed series of 'jobs' to the price store at 'path' (see store_write),
+ * then print their tickers in order, which main -s reads like filenames
  */
-string make_url(string const & ticker,
-                     string const & token,
-                     char const *begin,
-                     char const *end)
+void write_store(char const *path, vector<fetch> & jobs, int compress)
 {
-	auto url = urlbase + ticker + ".csv?order=asc&api_key=" + token;
-	if (begin) {
-		url.append("&start_date=");
-		url.append(begin);
+	vector<store_series> all;
+	vector<string> names;
+	for (auto & job : jobs) {
+		char const *ticker = job.ticker.c_str();
+		if (job.parser.unordered > 0) {
+			warn("Dates out of order for %s, skipped %ld rows\n", ticker, job.parser.unordered);
+		}
+		if (char const *why = csv_unusable(&job.parser, &job.data)) {
+			warn("Skipping %s: %s\n", ticker, why);
+			continue;
+		}
+		if (job.ticker.size() >= STORE_TICKER_LEN) {
+			warn("Ticker name too long, skipping: %s\n", ticker);
+			continue;
+		}
+		names.push_back(job.ticker);
+		all.push_back(move(job.data));
 	}
-	if (end) {
-		url.append("&end_date=");
-		url.append(end);
+	sort(all.begin(), all.end(), [](store_series const & a, store_series const & b) {
+		return a.ticker < b.ticker;
+	});
+	/* a ticker given twice was downloaded twice; the copies are the same */
+	all.erase(unique(all.begin(), all.end(), [](store_series const & a, store_series const & b) {
+		return a.ticker == b.ticker;
+	}), all.end());
+	if (all.empty()) {
+		die("No price data to write to %s\n", path);
 	}
-	return url;
-}
-
-/*
- * make_filename("/path/to/dir","TICKER","begin","end") = "/path/to/dir/TICKER.begin.end.csv"
- * where:
- *   begin, end are of the form YYYY-mm-dd
- */
-string make_filename(string const & dbroot, string const & ticker,
-                          char const *begin, char const *end)
-{
-	stringstream fname;
-	fname << dbroot;
-	if (dbroot.back() != '/') {
-		fname << '/';
+	if (store_write(path, all, compress) == -1) {
+		perror("store_write");
+		die("Failed to write store %s\n", path);
 	}
-	fname << ticker;
-	if (begin && end) {
-		fname << '.' << begin << '.' << end;
+	for (auto const & name : names) {
+		printf("%s\n", name.c_str());
 	}
-	fname << ".csv";
-	return fname.str();
-}
-
-/* get paths to all files in database */
-vector<string> get_db_files(string const & dbroot)
-{
-	char command[512];
-	char buf[512];
-	FILE *ls;
-	vector<string> files;
-
-	sprintf(command, "ls %s/*.csv 2>/dev/null", dbroot.c_str());
-	ls = popen(command, "r");
-	while (fgets(buf, sizeof buf, ls)) {
-		strip(buf);
-		files.emplace_back(buf);
-	}
-	pclose(ls);
-	return files;
-}
-
-vector<string>::iterator
-find_file_by_ticker(string const & ticker,
-                    vector<string> & files)
-
-{
-	char const *t = ticker.c_str();
-	auto it = files.begin();
-	for ( ; it != files.end(); it++) {
-		char const *fstr = it->c_str();
-		if (strcasestr(fstr, t) != NULL) {
-			return it;
-		}
-	}
-	return it;
-}
-
-/* check if _filename includes the dates specified */
-int has_data(string const & _filename, char const *a_begin, char const *a_end)
-{
-	struct stat buf;
-	char const *filename;
-	char const *begin_date, *end_date;
-	struct tm begin_tm, end_tm;
-	time_t begin, end, argbegin, argend;
-
-	memset(&buf, 0, sizeof buf);
-	memset(&begin_tm, 0, sizeof begin_tm);
-	memset(&end_tm, 0, sizeof end_tm);
-
-	filename = _filename.c_str();
-	if (stat(filename, &buf) == -1)
-		return 0;
-	char const *last_slash = strrchr(filename, '/');
-	if (last_slash != NULL)
-		filename = last_slash + 1;
-
-	begin_date = strchr(filename, '.');
-	if (begin_date == NULL)
-		return 0;
-	if (strcmp(begin_date, ".csv") == 0) /* there are no dates in filename */
-		return 0;
-	begin_date++;
-
-	end_date = strptime(begin_date, DATE_FMT, &begin_tm);
-	if (end_date == NULL || *end_date == '\0') {
-		/* and error occurred, or there is no ending date after the beginning date */
-		return 0;
-	}
-	if (*end_date != '.')
-		return 0;
-	end_date++;
-	if (strptime(end_date, DATE_FMT, &end_tm) == NULL)
-		return 0;
-
-	/* convert broken-down time (struct tm) to an integral type (time_t), parse user strings, and compare */
-	begin = mktime(&begin_tm);
-	end   = mktime(&end_tm);
-	memset(&begin_tm, 0, sizeof begin_tm);
-	memset(&end_tm,   0, sizeof end_tm);
-	if (strptime(a_begin, DATE_FMT, &begin_tm) == NULL)
-		return 0;
-	if (strptime(a_end,   DATE_FMT, &end_tm) == NULL)
-		return 0;
-	argbegin = mktime(&begin_tm);
-	argend   = mktime(&end_tm);
-	if (begin <= argbegin && end >= argend)
-		return 1;
-	return 0;
-}
-
-/*
- * Curl Callback to write directly to a file.
- */
-size_t curl_callback_fwrite(void *buf, size_t size, size_t nmemb, void *file)
-{
-	fwrite(buf, size, nmemb, (FILE *)file);
-	return size * nmemb;
-}
-
-void die(char const *fmt, ...)
-{
-	va_list args;
-
-	va_start(args, fmt);
-	vfprintf(stdout, fmt, args);
-	va_end(args);
-	exit(1);
+	fflush(stdout);
 }
 
 void usage(char const *argv0)
 {
 	printf(
-	"Usage: %s [-h|--help] [-k FILE] [-b DATE] [-e DATE] [-o DIR] -- [TICKER...]\n"
+	"Usage: %s [-h|--help] [-k FILE] [-b DATE] [-e DATE] [-o DIR] [-s FILE] [-z] [-j N] [-r RATE] [-R N] [-u URL] -- [TICKER...]\n"
 	"    -h,--help             show this help message\n"
 	"    -k                    file containing a Quandl api key (required)\n"
 	"    -b                    Beginning date, YYYY-mm-dd\n"
 	"    -e                    Ending date, YYYY-mm-dd\n"
 	"    -o                    Output directory. If this is omitted\n"
 	"                          default behavior is to print to stdout\n"
+	"    -s                    Parse the downloads as they arrive and write their dates and\n"
+	"                          closing prices to this binary price store (see mkstore),\n"
+	"                          with no CSV files. Prints the tickers instead of filenames,\n"
+	"                          for main -s. With -o, CSV files already in DIR are used\n"
+	"    -z                    Compress the store written by -s\n"
+	"    -j                    Number of downloads to run at once (default: %d)\n"
+	"    -r                    Requests to start a second, on average; 0 for no limit (default: %g)\n"
+	"    -R                    Times to retry a download that was throttled (HTTP 429) or\n"
+	"                          failed on the server's side (5xx, broken connection) (default: %d)\n"
+	"    -u                    Base URL of the data sets (default: %s)\n"
+	"                          TICKER.csv?... is appended to it\n"
 	"    TICKER...             One or more stock symbols.\n"
 	"\n"
-	"    All of the arguments are required\n"
-	,argv0);
+	"    All of the arguments are required, except -z, -j, -r, -R and -u, and -o with -s\n"
+	,argv0
+	,DEFAULT_JOBS
+	,DEFAULT_RATE
+	,DEFAULT_RETRIES
+	,DEFAULT_URLBASE);
 	exit(1);
 }
 
@@ -307,16 +145,21 @@ int main(int argc, char **argv)
 	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
 		usage(argv0);
 	}
-	CURL *curl;                /* libcurl state */
 	string api_key_file;
 	string api_key;
 	string begin;         /* beginning and ending dates */
 	string end;
 	string dbroot;        /* root directory of the database (passed by the user via [-o] option) */
-	vector<string> dbfiles;     /* all .csv files found in dbroot */
+	catalog cat;          /* the files in dbroot */
 	int ac;
 	char **av;
-	string buffer;        /* memory buffer containing the stock data */
+	string urlbase = DEFAULT_URLBASE;
+	string store_path;    /* binary price store to write, if any */
+	int compress = 0;     /* ... compressed */
+	int jobs = DEFAULT_JOBS;  /* downloads in flight at once */
+	double rate = DEFAULT_RATE;  /* requests started a second, 0 for no limit */
+	int retries = DEFAULT_RETRIES;
+	char *endptr;
 
 	/* parsing command line options */
 	for (ac = argc - 1, av = argv + 1;
@@ -349,6 +192,43 @@ int main(int argc, char **argv)
 				dbroot = tmp;
 				brk_ = 1;
 				break;
+			case 's':
+				tmp = (opt[1] != '\0') ? (opt + 1) : (--ac, *(++av));
+				store_path = tmp;
+				brk_ = 1;
+				break;
+			case 'z':
+				compress = 1;
+				break;
+			case 'j':
+				tmp = (opt[1] != '\0') ? (opt + 1) : (--ac, *(++av));
+				jobs = strtol(tmp, &endptr, 10);
+				if (jobs <= 0 || *endptr != '\0') {
+					die("Failed to parse number of jobs: %s\n", tmp);
+				}
+				brk_ = 1;
+				break;
+			case 'r':
+				tmp = (opt[1] != '\0') ? (opt + 1) : (--ac, *(++av));
+				rate = strtod(tmp, &endptr);
+				if (rate < 0 || *endptr != '\0' || endptr == tmp) {
+					die("Failed to parse request rate: %s\n", tmp);
+				}
+				brk_ = 1;
+				break;
+			case 'R':
+				tmp = (opt[1] != '\0') ? (opt + 1) : (--ac, *(++av));
+				retries = strtol(tmp, &endptr, 10);
+				if (retries < 0 || *endptr != '\0' || endptr == tmp) {
+					die("Failed to parse number of retries: %s\n", tmp);
+				}
+				brk_ = 1;
+				break;
+			case 'u':
+				tmp = (opt[1] != '\0') ? (opt + 1) : (--ac, *(++av));
+				urlbase = tmp;
+				brk_ = 1;
+				break;
 			case 'h':
 				usage(argv0);
 			default:
@@ -372,55 +252,41 @@ int main(int argc, char **argv)
 	if (api_key.empty()) {
 		die("Failed to read api key from file: %s\n", api_key_file.c_str());
 	}
-	if (dbroot.empty()) {
+	if (dbroot.empty() && store_path.empty()) {
 		die("Database root is required\n");
 	}
 
-	/* remove any trailing '/' characters from the path */
-	if (dbroot.size() > 1) {
+	if (!dbroot.empty()) {
+		/* remove any trailing '/' characters from the path */
 		while (dbroot.size() > 1 && dbroot.back() == '/') {
 			dbroot.pop_back();
 		}
+		int status = database_init(dbroot.c_str());
+		if (status == -1) {
+			perror("database_init:");
+			die("Failed to initialize the database\nAborting\n");
+		}
+		catalog_load(&cat, dbroot);
 	}
-
-	int status = database_init(dbroot.c_str());
-	if (status == -1) {
-		perror("database_init:");
-		die("Failed to initialize the database\nAborting\n");
-	}
-	dbfiles = get_db_files(dbroot);
+	int parse = !store_path.empty();
 
 	printf("%s\n%s\n", begin.c_str(), end.c_str());
-	curl = curl_easy_init();
+	fflush(stdout);
+	vector<fetch> fetches;
 	for ( ; ac && *av; ac--, av++) {
-		auto ticker = upper(*av);
-		auto found = find_file_by_ticker(ticker, dbfiles);
-		string filename;
-		FILE *file;
-		if (found != dbfiles.end()) {
-			filename = *found;
-			if (has_data(filename, begin.c_str(), end.c_str())) {
-				printf("%s\n", filename.c_str());
-				continue;
-			} else { /* remove this file, replace it with the new one */
-				remove(filename.c_str());
-				*found = filename = make_filename(dbroot, ticker, begin.c_str(), end.c_str());
-			}
-		} else {
-			filename = make_filename(dbroot, ticker, begin.c_str(), end.c_str());
-		}
-		file = fopen(filename.c_str(), "w");
-		auto url = make_url(ticker, api_key, begin.c_str(), end.c_str());
-		char const *urlc = url.c_str();
-
-		curl_easy_setopt(curl, CURLOPT_URL, urlc);
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_callback_fwrite);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
-		curl_easy_perform(curl);
-		fclose(file);
-		printf("%s\n", filename.c_str());
+		fetches.push_back(fetch_job(&cat, dbroot, urlbase, api_key, upper(*av), begin, end, parse));
+	}
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	download_all(fetches, jobs, rate, retries, parse ? NULL : stdout);
+	curl_global_cleanup();
+	if (!dbroot.empty()) {
+		catalog_update(&cat, fetches);
+		if (catalog_save(cat, dbroot) == -1)
+			warn("Failed to write %s/" CATALOG_NAME ": %s\n", dbroot.c_str(), strerror(errno));
+	}
+	if (parse) {
+		write_store(store_path.c_str(), fetches, compress);
 	}
-	curl_easy_cleanup(curl);
 }
 
 /*
@@ -428,3 +294,4 @@ int main(int argc, char **argv)
  * set follow-fork-mode parent
  * set detach-on-fork on
  */
+
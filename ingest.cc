@@ -0,0 +1,301 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Reading closing prices, from CSV files or a price store, into a price panel
+ */
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <math.h>   /* isnan */
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>/* stable_partition */
+#include <functional> /* greater */
+#include <queue>    /* priority_queue */
+#include <utility>  /* move */
+
+#include <Eigen/Core>
+
+#include "pricestore.h"
+#include "util.h"
+#include "ingest.h"
+
+using namespace std;
+using namespace Eigen;
+
+template <typename Iter, typename Container>
+typename Container::iterator index_remove(Iter ixbegin, Iter ixend, Container & C)
+{
+	int ix = 0;
+	return stable_partition(C.begin(),C.end(),[&](typename Container::value_type const & unused) {
+		return find(ixbegin,ixend,ix++) == ixend;
+	});
+}
+
+/* the result of reading one CSV file, see read_stock_file */
+struct stock_file {
+	string ticker;
+	vector<int32_t> dates;  /* ascending days, see parse_date */
+	vector<double> prices;  /* prices[i] is the closing price on dates[i] */
+	string warnings;  /* printed in input order after every file has been read */
+	string error;     /* set if no panel can be read, because of this file */
+	bool ok;          /* false if the file was rejected */
+};
+
+/*
+ * read_stock_file
+ *   read the prices between 'start' and 'end' from the CSV file 'f' into 'out'.
+ *   Nothing is printed here so that files can be read concurrently; the
+ *   caller reports out->warnings and out->error in order.
+ */
+void read_stock_file(char const *f, int32_t start, int32_t end, stock_file *out)
+{
+	csv_parser p;
+	store_series s;
+
+	out->ok = false;
+	if (csv_read_file(f, &p, &s) == -1) {
+		appendf(&out->error, "Failed to open file %s: %s\n", f, strerror(errno));
+		return;
+	}
+	out->ticker = ticker_from_filename(f);
+	char const *ticker = out->ticker.c_str();
+	if (!p.header) {
+		appendf(&out->warnings, "File %s is empty\n", f);
+		return;
+	}
+	if (p.close_index == -1) {
+		appendf(&out->warnings, "Could not find closing price data for: %s\n", ticker);
+		return;
+	}
+	if (p.date_index == -1) {
+		appendf(&out->warnings, "Could not find date field for: %s\n", ticker);
+		return;
+	}
+	if (p.skipped > 0) {
+		appendf(&out->warnings, "Skipped %ld rows without a date and closing price in %s\n", p.skipped, f);
+	}
+	if (p.unordered > 0) {
+		appendf(&out->warnings, "Dates out of order in %s, skipped %ld rows\n", f, p.unordered);
+	}
+	/* keep the rows in [start, end] */
+	auto first = lower_bound(s.dates.begin(), s.dates.end(), start);
+	auto last = upper_bound(first, s.dates.end(), end);
+	if (first == s.dates.end()) {
+		appendf(&out->warnings, "Data has no observations >= start date: %s\n", f);
+		return;
+	}
+	if (first == last) {
+		/* every row is after 'end': nothing to join on, and no first price to fill with */
+		appendf(&out->warnings, "Data has no observations between the start and end dates: %s\n", f);
+		return;
+	}
+	out->dates.assign(first, last);
+	out->prices.assign(s.prices.begin() + (first - s.dates.begin()), s.prices.begin() + (last - s.dates.begin()));
+	out->ok = true;
+}
+
+/*
+ * merge_dates
+ *   k-way merge of the (ascending) dates of 'files'. visit(row, date, j, pos)
+ *   is called for row 'pos' of files[j], in date order, where 'row' is the index
+ *   of 'date' in the union of all the dates.
+ *   returns the number of distinct dates.
+ */
+template <typename Visit>
+int merge_dates(vector<stock_file *> const & files, Visit visit)
+{
+	typedef pair<int32_t, int> cursor;  /* (date, index into files) */
+	priority_queue<cursor, vector<cursor>, greater<cursor> > heap;
+	vector<int> pos(files.size(), 0);
+	int row = -1;
+	int32_t last = 0;
+
+	for (int j = 0; j < (int) files.size(); j++) {
+		if (!files[j]->dates.empty())
+			heap.emplace(files[j]->dates[0], j);
+	}
+	while (!heap.empty()) {
+		cursor c = heap.top();
+		heap.pop();
+		if (row == -1 || c.first != last) {
+			row++;
+			last = c.first;
+		}
+		int j = c.second;
+		visit(row, last, j, pos[j]);
+		if (++pos[j] < (int) files[j]->dates.size())
+			heap.emplace(files[j]->dates[pos[j]], j);
+	}
+	return row + 1;
+}
+
+/*
+ * read_stock_data
+ *   return the panel of prices for the files in 'filepaths', between 'start' and 'end'.
+ *   Files that cannot be used are removed from 'filepaths'.
+ */
+price_panel
+read_stock_data(vector<string> & filepaths, int32_t start, int32_t end)
+{
+	/* it could be the case that the dates in the files do not match up.
+	 * The files are joined on date, so row i of the panel is the same day for
+	 * every ticker. A ticker may be missing a couple of those days (some slack,
+	 * for bad data); tickers missing more are dropped.
+	 */
+	price_panel panel;
+	map<string, int> byticker; /* ticker -> index into parsed. sorted, so the columns are too */
+	vector<int> ixrm;  /* for index_remove - indices of any data sources to remove because they don't have correct data */
+	int nfiles = filepaths.size();
+	vector<stock_file> parsed(nfiles);
+
+	/* every file is parsed into its own buffer, in parallel. dynamic scheduling
+	 * because file sizes vary a lot (a recent IPO vs. decades of history) */
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < nfiles; i++) {
+		read_stock_file(filepaths[i].c_str(), start, end, &parsed[i]);
+	}
+
+	/* report in input order, so the warnings (and which of two files for the same
+	 * ticker wins) are the same as reading the files one at a time */
+	for (int i = 0; i < nfiles; i++) {
+		stock_file & pf = parsed[i];
+		warn("%s", pf.warnings.c_str());
+		if (!pf.error.empty()) {
+			panel.error = pf.error;
+			return panel;
+		}
+		if (!pf.ok) {
+			ixrm.push_back(i);
+			continue;
+		}
+		byticker[pf.ticker] = i;
+	}
+	filepaths.erase(index_remove(ixrm.begin(),ixrm.end(), filepaths), filepaths.end());
+
+	vector<stock_file *> files;
+	for (auto const & pair : byticker) {
+		files.push_back(&parsed[pair.second]);
+	}
+	int required = merge_dates(files, [](int, int32_t, int, int) {}) - 2; /* add some slack */
+	files.erase(remove_if(files.begin(), files.end(), [&](stock_file *pf) {
+		if ((int) pf->dates.size() < required) {
+			warn("Not enough observations for %s: has %d of %d required\n", pf->ticker.c_str(), (int) pf->dates.size(), required);
+			return true;
+		}
+		return false;
+	}), files.end());
+
+	/* join on date, writing straight into the panel */
+	int nrow = merge_dates(files, [](int, int32_t, int, int) {});
+	int ncol = files.size();
+	panel.dates.resize(nrow);
+	panel.prices.resize(nrow, ncol);
+	panel.mask.setZero(nrow, ncol);
+	merge_dates(files, [&](int row, int32_t date, int j, int pos) {
+		panel.dates[row] = date;
+		panel.prices(row, j) = files[j]->prices[pos];
+		panel.mask(row, j) = 1;
+	});
+	for (int j = 0; j < ncol; j++) {
+		double *p = panel.prices.col(j).data();
+		unsigned char const *m = panel.mask.col(j).data();
+		double last = files[j]->prices.front();
+		for (int i = 0; i < nrow; i++) {
+			if (m[i])
+				last = p[i];
+			else
+				p[i] = last;
+		}
+		panel.tickers.push_back(move(files[j]->ticker));
+	}
+	return panel;
+}
+
+/*
+ * read_store_data
+ *   the panel read_stock_data would give, straight from a price store (see pricestore.h).
+ *   'filepaths' selects the tickers to use, by the same TICKER.begin.end.csv names
+ *   that read_stock_data takes (bare tickers work too). If it is empty, every
+ *   ticker in the store is used.
+ */
+price_panel
+read_store_data(char const *path, vector<string> const & filepaths, int32_t start, int32_t end)
+{
+	price_store store;
+	vector<int> cols;
+	price_panel panel;
+
+	if (store_open(path, &store) == -1) {
+		appendf(&panel.error, "Failed to open price store %s: %s\n", path, strerror(errno));
+		return panel;
+	}
+	if (filepaths.empty()) {
+		for (int j = 0; j < store.ntickers; j++)
+			cols.push_back(j);
+	}
+	for (auto const & f : filepaths) {
+		auto ticker = ticker_from_filename(f.c_str());
+		int j = store_find(&store, ticker.c_str());
+		if (j == -1) {
+			warn("No data for %s in store %s\n", ticker.c_str(), path);
+			continue;
+		}
+		cols.push_back(j);
+	}
+	/* store columns are sorted by ticker, same order as read_stock_data's map */
+	sort(cols.begin(), cols.end());
+	cols.erase(unique(cols.begin(), cols.end()), cols.end());
+
+	int lo = lower_bound(store.dates, store.dates + store.ndates, start) - store.dates;
+	int hi = upper_bound(store.dates, store.dates + store.ndates, end) - store.dates;
+	int nobs = hi - lo;
+	if (nobs < 5) {
+		appendf(&panel.error, "Store %s has %d observations between the start and end dates\n", path, nobs);
+		store_close(&store);
+		return panel;
+	}
+
+	/* same slack as read_stock_data: a ticker may be missing up to 2 days,
+	 * which are filled with the nearest earlier (or, at the start, later) price */
+	vector<int> keep;
+	for (int j : cols) {
+		double const *p = store_column(&store, j) + lo;
+		int have = 0;
+		for (int i = 0; i < nobs; i++)
+			have += !isnan(p[i]);
+		if (have < nobs - 2) {
+			warn("Not enough observations for %s: has %d of %d required\n", store_ticker(&store, j), have, nobs - 2);
+			continue;
+		}
+		keep.push_back(j);
+	}
+
+	panel.dates.assign(store.dates + lo, store.dates + hi);
+	panel.prices.resize(nobs, keep.size());
+	panel.mask.resize(nobs, keep.size());
+	for (int c = 0; c < (int) keep.size(); c++) {
+		double const *p = store_column(&store, keep[c]) + lo;
+		double *q = panel.prices.col(c).data();
+		unsigned char *m = panel.mask.col(c).data();
+		double last = *find_if(p, p + nobs, [](double x) { return !isnan(x); });
+		for (int i = 0; i < nobs; i++) {
+			m[i] = !isnan(p[i]);
+			q[i] = last = m[i] ? p[i] : last;
+		}
+		panel.tickers.emplace_back(store_ticker(&store, keep[c]));
+	}
+	store_close(&store);
+	return panel;
+}
@@ -0,0 +1,57 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Reading closing prices, from CSV files or a price store, into a price panel
+ */
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+/*
+ * Prices of every ticker on a shared date axis.
+ * prices is dates.size()-by-tickers.size() and column-major, so the history of
+ * one ticker is contiguous. mask(i, j) is 1 if ticker j has a row for dates[i];
+ * where it is 0, prices(i, j) holds the nearest earlier price (or the first
+ * price, before the ticker's first row).
+ * A panel built in memory, by a program with its own data source, can be given
+ * to every function of the library that the ones read from files are.
+ * error is set, and the panel empty, if the data could not be read at all.
+ */
+struct price_panel {
+	std::vector<int32_t> dates;
+	std::vector<std::string> tickers;
+	Eigen::MatrixXd prices;
+	Eigen::Matrix<unsigned char, Eigen::Dynamic, Eigen::Dynamic> mask;
+	std::string error;
+};
+
+/*
+ * the panel of prices for the CSV files in 'filepaths', between days 'start'
+ * and 'end' (see parse_date). Files that cannot be used are removed from 'filepaths',
+ * with a warning. A file that cannot be opened sets the panel's error.
+ */
+price_panel read_stock_data(std::vector<std::string> & filepaths, int32_t start, int32_t end);
+
+/*
+ * the panel of prices in the price store at 'path' (see pricestore.h), between
+ * days 'start' and 'end'. 'filepaths' selects the tickers, by the names that
+ * read_stock_data takes (bare tickers work too); if it is empty, every ticker
+ * in the store is used. If the store cannot be opened, or has fewer than 5 dates
+ * between 'start' and 'end', the panel's error is set.
+ */
+price_panel read_store_data(char const *path, std::vector<std::string> const & filepaths,
+                            int32_t start, int32_t end);
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Convert a directory of CSV files (written by getstock) into a binary price store
+ */
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>    /* strcasecmp */
+
+#include <algorithm>    /* sort, unique */
+#include <string>
+#include <vector>
+
+#include <dirent.h>     /* opendir, readdir */
+#include <sys/stat.h>   /* stat */
+
+#include "pricestore.h"
+#include "util.h"
+
+using namespace std;
+
+/*
+ * read the date and closing price columns of a CSV file.
+ * returns 0 on success, -1 if the file is unusable (a warning has been printed)
+ */
+int read_series(char const *path, store_series *s)
+{
+	csv_parser p;
+
+	s->ticker = ticker_from_filename(path);
+	if (csv_read_file(path, &p, s) == -1) {
+		warn("Failed to open file %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (p.unordered > 0) {
+		warn("Dates out of order in %s, skipped %ld rows\n", path, p.unordered);
+	}
+	if (char const *why = csv_unusable(&p, s)) {
+		warn("File %s has %s\n", path, why);
+		return -1;
+	}
+	return 0;
+}
+
+void usage(char const *argv0)
+{
+	printf(
+	"Usage: %s [-h|--help] [-z] [-o FILE] DIR\n"
+	"    -h,--help             show this help message\n"
+	"    -o FILE               Output store (default: DIR/prices.store)\n"
+	"    -z                    Compress the store (main -s reads either kind)\n"
+	"    DIR                   Directory of TICKER.begin.end.csv files, as written by getstock -o DIR\n"
+	"\n"
+	"Example usage\n"
+	"    $ %s -o prices.store data\n"
+	"    $ ./getstock -k apikey -b 2018-01-01 -e 2018-04-01 -o data -- JPM BAC GS | ./main -s prices.store\n"
+	,argv0
+	,argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char const *argv0 = argv[0];
+	string dbroot;
+	string output;
+	int compress = 0;
+	int ac;
+	char **av;
+
+	for (ac = argc - 1, av = argv + 1;
+	       ac && *av && av[0][0] == '-' && av[0][1]; ac--, av++) {
+		if (av[0][1] == '-' && av[0][2] == '\0') {
+			ac--; av++;
+			break;
+		}
+		char *opt, *tmp;
+		int brk_ = 0;
+		for (opt = (*av) + 1; *opt && !brk_; opt++) {
+			switch (*opt) {
+			case 'o':
+				tmp = (opt[1] != '\0') ? (opt + 1) : (--ac, *(++av));
+				output = tmp;
+				brk_ = 1;
+				break;
+			case 'z':
+				compress = 1;
+				break;
+			case 'h':
+				usage(argv0);
+			default:
+				usage(argv0);
+			}
+		}
+	}
+	if (!ac) {
+		usage(argv0);
+	}
+	dbroot = *av;
+	while (dbroot.size() > 1 && dbroot.back() == '/') {
+		dbroot.pop_back();
+	}
+	if (output.empty()) {
+		output = dbroot + "/prices.store";
+	}
+
+	/* collect the .csv files in dbroot, sorted so the store is reproducible */
+	vector<string> files;
+	DIR *dir = opendir(dbroot.c_str());
+	if (!dir) {
+		perror("opendir");
+		die("Failed to open directory %s\n", dbroot.c_str());
+	}
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		size_t len = strlen(ent->d_name);
+		if (len > 4 && strcasecmp(ent->d_name + len - 4, ".csv") == 0)
+			files.push_back(dbroot + "/" + ent->d_name);
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+
+	vector<store_series> all;
+	for (auto const & f : files) {
+		store_series s;
+		if (read_series(f.c_str(), &s) == -1)
+			continue;
+		if (s.ticker.size() >= STORE_TICKER_LEN) {
+			warn("Ticker name too long, skipping: %s\n", s.ticker.c_str());
+			continue;
+		}
+		all.push_back(move(s));
+	}
+	sort(all.begin(), all.end(), [](store_series const & a, store_series const & b) {
+		if (a.ticker != b.ticker)
+			return a.ticker < b.ticker;
+		return a.dates.size() > b.dates.size();
+	});
+	/* if a ticker has more than one file, keep the one with the most rows */
+	all.erase(unique(all.begin(), all.end(), [](store_series const & a, store_series const & b) {
+		if (a.ticker == b.ticker) {
+			warn("Duplicate data for %s, keeping the longest file\n", a.ticker.c_str());
+			return true;
+		}
+		return false;
+	}), all.end());
+	if (all.empty()) {
+		die("No usable CSV files found in %s\n", dbroot.c_str());
+	}
+
+	/* the shared date axis is the union of every ticker's dates */
+	if (store_write(output.c_str(), all, compress) == -1) {
+		perror("store_write");
+		die("Failed to write store %s\n", output.c_str());
+	}
+	price_store st;
+	if (store_open(output.c_str(), &st) == 0) {
+		struct stat sb;
+		stat(output.c_str(), &sb);
+		printf("%s: %d tickers, %d dates, %ld bytes\n", output.c_str(), st.ntickers, st.ndates, (long) sb.st_size);
+		store_close(&st);
+	}
+	return 0;
+}
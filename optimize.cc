@@ -0,0 +1,1094 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Minimum variance portfolios, by Monte Carlo simulation or quadratic programming
+ */
+#include <math.h>   /* log, fabs, HUGE_VAL */
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>/* sort, min_element, push_heap, pop_heap */
+#include <utility>  /* swap */
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h> /* AVX2, see simplex_block() */
+#endif
+
+#include <omp.h>
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky> /* LDLT */
+#include <Eigen/QR>       /* HouseholderQR */
+
+#include "util.h"
+#include "covariance.h"
+#include "optimize.h"
+
+using namespace std;
+using namespace Eigen;
+
+/*
+ * Philox4x32-10, a counter-based random number generator
+ * (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011).
+ * 'out' is a pure function of 'ctr' and 'key', so any thread can compute the
+ * numbers for any portfolio without sharing or seeding a generator.
+ */
+static inline void philox4x32_10(uint32_t const ctr[4], uint32_t const key[2], uint32_t out[4])
+{
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int round = 0; round < 10; round++) {
+		uint64_t p0 = (uint64_t) 0xD2511F53 * c0;
+		uint64_t p1 = (uint64_t) 0xCD9E8D57 * c2;
+		c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+		c1 = (uint32_t) p1;
+		c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+		c3 = (uint32_t) p0;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+/*
+ * last step of simplex_block(), for one portfolio of n uniform numbers:
+ * take -log of them for SAMPLE_DIRICHLET, then divide by their sum.
+ * the sum is kept in 4 partial sums (element i goes to sum i % 4) so that
+ * simplex_finish_avx2() gives exactly the same weights.
+ */
+static inline void simplex_finish(double *w, int n, int sampler)
+{
+	double s[4] = {0.0, 0.0, 0.0, 0.0};
+
+	if (sampler == SAMPLE_DIRICHLET) {
+		for (int i = 0; i < n; i++)
+			w[i] = -log(w[i]);
+	}
+	for (int i = 0; i < n; i++)
+		s[i % 4] += w[i];
+	double sum = (s[0] + s[1]) + (s[2] + s[3]);
+	for (int i = 0; i < n; i++)
+		w[i] /= sum;
+}
+
+/*
+ * fill the nb columns of W (n x nb, column-major) with the weights of portfolios
+ * number first, ..., first + nb - 1 of simulation 'stream', under 'seed'.
+ * element i of portfolio t is word i % 4 of philox4x32_10 at counter
+ * (i / 4, t, stream), mapped to a uniform number in (0, 1), so every
+ * (seed, stream, t) gets its own sequence.
+ */
+void simplex_block_scalar(uint64_t seed, uint32_t stream, uint64_t first,
+                          int nb, int n, int sampler, double *W)
+{
+	uint32_t key[2] = { (uint32_t) seed, (uint32_t) (seed >> 32) };
+	uint32_t ctr[4];
+	uint32_t out[4];
+
+	for (int j = 0; j < nb; j++) {
+		double *w = W + (size_t) j * n;
+		uint64_t trial = first + j;
+		ctr[1] = (uint32_t) trial;
+		ctr[2] = (uint32_t) (trial >> 32);
+		ctr[3] = stream;
+		for (int i = 0; i < n; i += 4) {
+			ctr[0] = i / 4;
+			philox4x32_10(ctr, key, out);
+			for (int k = 0; k < 4 && i + k < n; k++)
+				w[i + k] = (out[k] + 0.5) * (1.0 / 4294967296.0);
+		}
+		simplex_finish(w, n, sampler);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * AVX2 version of simplex_block_scalar(), with the same output bit for bit:
+ * the philox4x32_10 rounds run on 8 counters at once (one per 32 bit lane),
+ * taken in order over (portfolio, i / 4), and the sums and divisions of
+ * simplex_finish() run 4 doubles at a time.
+ */
+__attribute__((target("avx2")))
+static void simplex_finish_avx2(double *w, int n, int sampler)
+{
+	double s[4];
+	int i;
+
+	if (sampler == SAMPLE_DIRICHLET) {
+		for (i = 0; i < n; i++)
+			w[i] = -log(w[i]);
+	}
+	__m256d acc = _mm256_setzero_pd();
+	for (i = 0; i + 4 <= n; i += 4)
+		acc = _mm256_add_pd(acc, _mm256_loadu_pd(w + i));
+	_mm256_storeu_pd(s, acc);
+	for ( ; i < n; i++)
+		s[i % 4] += w[i];
+	double sum = (s[0] + s[1]) + (s[2] + s[3]);
+	__m256d vsum = _mm256_set1_pd(sum);
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(w + i, _mm256_div_pd(_mm256_loadu_pd(w + i), vsum));
+	for ( ; i < n; i++)
+		w[i] /= sum;
+}
+
+/* (a * b) for 8 lanes of 32 bits: the high halves in *hi, the low halves in *lo */
+__attribute__((target("avx2")))
+static inline void mulhilo_avx2(__m256i a, __m256i b, __m256i *hi, __m256i *lo)
+{
+	__m256i even = _mm256_mul_epu32(a, b);
+	__m256i odd  = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+	*lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+	*hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+__attribute__((target("avx2")))
+static void simplex_block_avx2(uint64_t seed, uint32_t stream, uint64_t first,
+                               int nb, int n, int sampler, double *W)
+{
+	int nchunk = (n + 3) / 4;      /* philox4x32_10 calls per portfolio */
+	int total = nb * nchunk;
+	__m256i const m0 = _mm256_set1_epi32((int) 0xD2511F53);
+	__m256i const m1 = _mm256_set1_epi32((int) 0xCD9E8D57);
+	__m256i const w0 = _mm256_set1_epi32((int) 0x9E3779B9);
+	__m256i const w1 = _mm256_set1_epi32((int) 0xBB67AE85);
+	__m128i const sign = _mm_set1_epi32((int) 0x80000000);
+	__m256d const bias = _mm256_set1_pd(2147483648.0 + 0.5);
+	__m256d const scale = _mm256_set1_pd(1.0 / 4294967296.0);
+
+	for (int f = 0; f < total; f += 8) {
+		alignas(32) uint32_t c[4][8];
+		double *dst[8];
+		int cnt[8];
+
+		for (int l = 0; l < 8; l++) {
+			int j = (f + l) / nchunk;
+			int i = (f + l) % nchunk * 4;
+			uint64_t trial = first + j;
+			c[0][l] = i / 4;
+			c[1][l] = (uint32_t) trial;
+			c[2][l] = (uint32_t) (trial >> 32);
+			c[3][l] = stream;
+			dst[l] = W + (size_t) j * n + i;
+			cnt[l] = (f + l < total) ? MIN(4, n - i) : 0;
+		}
+		__m256i c0 = _mm256_load_si256((__m256i const *) c[0]);
+		__m256i c1 = _mm256_load_si256((__m256i const *) c[1]);
+		__m256i c2 = _mm256_load_si256((__m256i const *) c[2]);
+		__m256i c3 = _mm256_load_si256((__m256i const *) c[3]);
+		__m256i k0 = _mm256_set1_epi32((int) (uint32_t) seed);
+		__m256i k1 = _mm256_set1_epi32((int) (uint32_t) (seed >> 32));
+		for (int round = 0; round < 10; round++) {
+			__m256i hi0, lo0, hi1, lo1;
+			mulhilo_avx2(c0, m0, &hi0, &lo0);
+			mulhilo_avx2(c2, m1, &hi1, &lo1);
+			c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+			c1 = lo1;
+			c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+			c3 = lo0;
+			k0 = _mm256_add_epi32(k0, w0);
+			k1 = _mm256_add_epi32(k1, w1);
+		}
+		/* transpose, so that out[m] holds the 4 words of lane 2m, then those of lane 2m + 1 */
+		__m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+		__m256i t1 = _mm256_unpackhi_epi32(c0, c1);
+		__m256i t2 = _mm256_unpacklo_epi32(c2, c3);
+		__m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+		__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+		__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+		__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+		__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+		__m256i out[4] = {
+			_mm256_permute2x128_si256(u0, u1, 0x20),
+			_mm256_permute2x128_si256(u2, u3, 0x20),
+			_mm256_permute2x128_si256(u0, u1, 0x31),
+			_mm256_permute2x128_si256(u2, u3, 0x31),
+		};
+		for (int l = 0; l < 8; l++) {
+			__m128i x = (l % 2 == 0) ? _mm256_castsi256_si128(out[l / 2])
+			                         : _mm256_extracti128_si256(out[l / 2], 1);
+			/* (x + 0.5) / 2^32, exactly as in simplex_block_scalar() */
+			__m256d u = _mm256_cvtepi32_pd(_mm_xor_si128(x, sign));
+			u = _mm256_mul_pd(_mm256_add_pd(u, bias), scale);
+			if (cnt[l] == 4) {
+				_mm256_storeu_pd(dst[l], u);
+			} else if (cnt[l] > 0) {
+				double tmp[4];
+				_mm256_storeu_pd(tmp, u);
+				memcpy(dst[l], tmp, cnt[l] * sizeof(double));
+			}
+		}
+	}
+	for (int j = 0; j < nb; j++)
+		simplex_finish_avx2(W + (size_t) j * n, n, sampler);
+}
+#endif
+
+/* simplex_block_scalar(), or its AVX2 version if this cpu has AVX2 */
+void simplex_block(uint64_t seed, uint32_t stream, uint64_t first,
+                   int nb, int n, int sampler, double *W)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	static int const have_avx2 = __builtin_cpu_supports("avx2");
+	if (have_avx2) {
+		simplex_block_avx2(seed, stream, first, nb, n, sampler, W);
+		return;
+	}
+#endif
+	simplex_block_scalar(seed, stream, first, nb, n, sampler, W);
+}
+
+/* a * b modulo p, polynomials over GF(2) as bit masks, p of degree 'deg' */
+static uint32_t gf2_mulmod(uint32_t a, uint32_t b, uint32_t p, int deg)
+{
+	uint32_t r = 0;
+	for ( ; b; b >>= 1) {
+		if (b & 1)
+			r ^= a;
+		a <<= 1;
+		if (a >> deg & 1)
+			a ^= p;
+	}
+	return r;
+}
+
+/* x^e modulo p, p of degree 'deg' */
+static uint32_t gf2_xpow(uint64_t e, uint32_t p, int deg)
+{
+	uint32_t r = 1;
+	uint32_t x = (deg == 1) ? (2 ^ p) : 2;
+	for ( ; e; e >>= 1) {
+		if (e & 1)
+			r = gf2_mulmod(r, x, p, deg);
+		x = gf2_mulmod(x, x, p, deg);
+	}
+	return r;
+}
+
+/* p of degree 'deg' is primitive iff x has order 2^deg - 1 modulo p */
+static int gf2_primitive(uint32_t p, int deg)
+{
+	uint64_t order = ((uint64_t) 1 << deg) - 1;
+	uint64_t rest = order;
+
+	if (gf2_xpow(order, p, deg) != 1)
+		return 0;
+	/* x^(order / q) must not be 1, for every prime factor q of order */
+	for (uint64_t q = 2; q <= rest; q++) {
+		if (q * q > rest)
+			q = rest;
+		if (rest % q != 0)
+			continue;
+		while (rest % q == 0)
+			rest /= q;
+		if (gf2_xpow(order / q, p, deg) == 1)
+			return 0;
+	}
+	return 1;
+}
+
+/* the defaults of every option, see optimize.h */
+void sim_options_init(sim_options *opts)
+{
+	opts->engine = ENGINE_MC;
+	opts->nsim = DEFAULT_NSIM;
+	opts->block = DEFAULT_BLOCK;
+	opts->topk = 0;
+	opts->seed = 0;
+	opts->sampler = SAMPLE_UNIFORM;
+	opts->qmc = NULL;
+	opts->precision = PRECISION_DOUBLE;
+}
+
+/* build the scrambled direction numbers of 'dims' dimensions, under 'seed' */
+void sobol_init(sobol *s, int dims, uint64_t seed)
+{
+	uint32_t const fixed[2] = { 0x50B01000, 0x1967 };
+	uint32_t const key[2] = { (uint32_t) seed, (uint32_t) (seed >> 32) };
+	uint32_t ctr[4], out[4];
+	uint32_t m[33];
+	uint32_t rows[32];
+	uint32_t poly = 1;
+	int deg = 0;
+
+	s->dims = dims;
+	s->v.assign((size_t) 32 * dims, 0);
+	for (int j = 0; j < dims; j++) {
+		uint32_t *v = &s->v[(size_t) 32 * j];
+		if (j == 0) {
+			for (int k = 1; k <= 32; k++)
+				m[k] = 1;
+		} else {
+			/* the next primitive polynomial, x^deg + ... + 1 */
+			do {
+				poly += 2;
+				if (poly >> (deg + 1)) {
+					deg++;
+					poly = (1u << deg) | 1;
+				}
+			} while (!gf2_primitive(poly, deg));
+			for (int k = 1; k <= deg && k <= 32; k++) {
+				ctr[0] = j; ctr[1] = k; ctr[2] = 0; ctr[3] = 0;
+				philox4x32_10(ctr, fixed, out);
+				m[k] = (out[0] & ((1u << k) - 1)) | 1;  /* odd, < 2^k */
+			}
+			for (int k = deg + 1; k <= 32; k++) {
+				m[k] = m[k - deg] ^ (m[k - deg] << deg);
+				for (int i = 1; i < deg; i++) {
+					if (poly >> (deg - i) & 1)
+						m[k] ^= m[k - i] << i;
+				}
+			}
+		}
+		/* digit r (from the most significant) of a scrambled direction number is
+		 * digit r of the original, plus the parity of a random subset of its digits 0..r-1 */
+		for (int r = 0; r < 32; r += 4) {
+			ctr[0] = r / 4; ctr[1] = j; ctr[2] = 0xFFFFFFFF; ctr[3] = 0xFFFFFFFF;
+			philox4x32_10(ctr, key, out);
+			for (int i = 0; i < 4; i++) {
+				uint32_t above = (r + i == 0) ? 0 : ~0u << (32 - (r + i));
+				rows[r + i] = (out[i] & above) | (1u << (31 - (r + i)));
+			}
+		}
+		for (int k = 1; k <= 32; k++) {
+			uint32_t d = m[k] << (32 - k), sd = 0;
+			for (int r = 0; r < 32; r++)
+				sd |= (uint32_t) __builtin_parity(rows[r] & d) << (31 - r);
+			v[k - 1] = sd;
+		}
+	}
+}
+
+/*
+ * SAMPLE_SOBOL version of simplex_block(): points first, ..., first + nb - 1
+ * of the sequence in dimensions 0..n-1, plus a digital shift drawn for
+ * (seed, stream), mapped onto the simplex like SAMPLE_DIRICHLET.
+ * Every block starts from its own first point, so blocks can be given to
+ * any thread and no two of them share a point. n is at most s->dims (see run()).
+ */
+void sobol_block(sobol const *s, uint64_t seed, uint32_t stream, uint64_t first,
+                 int nb, int n, double *W)
+{
+	uint32_t const key[2] = { (uint32_t) seed, (uint32_t) (seed >> 32) };
+	uint32_t ctr[4], out[4];
+	vector<uint32_t> x(n);
+
+	for (int i = 0; i < n; i += 4) {
+		ctr[0] = i / 4; ctr[1] = 0xFFFFFFFF; ctr[2] = 0xFFFFFFFF; ctr[3] = stream;
+		philox4x32_10(ctr, key, out);
+		for (int k = 0; k < 4 && i + k < n; k++)
+			x[i + k] = out[k];
+	}
+	uint64_t gray = first ^ (first >> 1);
+	for (int k = 0; gray; k++, gray >>= 1) {
+		if (gray & 1) {
+			for (int i = 0; i < n; i++)
+				x[i] ^= s->v[(size_t) 32 * i + k];
+		}
+	}
+	for (int j = 0; j < nb; j++) {
+		double *w = W + (size_t) j * n;
+		if (j > 0) {
+			/* Gray code order: point t differs from point t - 1 in direction ctz(t) */
+			int k = __builtin_ctzll(first + j);
+			for (int i = 0; i < n; i++)
+				x[i] ^= s->v[(size_t) 32 * i + k];
+		}
+		for (int i = 0; i < n; i++)
+			w[i] = (x[i] + 0.5) * (1.0 / 4294967296.0);
+		simplex_finish(w, n, SAMPLE_DIRICHLET);
+	}
+}
+
+/*
+ * The (at most) K feasible portfolios with the least variance seen so far, in
+ * storage allocated once: column s of w holds the weights of slot s, and
+ * 'heap' orders the slots in use as a max-heap on variance, so the worst
+ * portfolio kept is heap[0] and can be replaced in O(log K).
+ */
+struct topk {
+	MatrixXd w;
+	VectorXd var;
+	VectorXd mu;
+	vector<int> heap;
+};
+
+void topk_init(topk *t, int ncol, int K)
+{
+	t->w.resize(ncol, K);
+	t->var.resize(K);
+	t->mu.resize(K);
+	t->heap.clear();
+	t->heap.reserve(K);
+}
+
+/* offer a portfolio to 't'. it is kept if 't' is not full or it beats the worst one kept */
+template <typename Weights>
+void topk_push(topk *t, Weights const & w, double var, double mu)
+{
+	auto worse = [t](int a, int b) { return t->var[a] < t->var[b]; };
+	int slot;
+	if ((int) t->heap.size() < t->var.size()) {
+		slot = t->heap.size();
+		t->heap.push_back(slot);
+	} else if (var < t->var[t->heap[0]]) {
+		pop_heap(t->heap.begin(), t->heap.end(), worse);
+		slot = t->heap.back();
+	} else {
+		return;
+	}
+	t->w.col(slot) = w;
+	t->var[slot] = var;
+	t->mu[slot] = mu;
+	push_heap(t->heap.begin(), t->heap.end(), worse);
+}
+
+/* merge the portfolios kept in 'from' into 'into' */
+void topk_merge(topk *into, topk const & from)
+{
+	for (int slot : from.heap)
+		topk_push(into, from.w.col(slot), from.var[slot], from.mu[slot]);
+}
+
+/*
+ * the variances and mean returns of the portfolios in the columns of W, computed
+ * in the precision S: with the dense covariance matrix C if factors == 0, else
+ * with the factor model B B^T + diag(D) (see cov_model). CW is scratch space.
+ */
+template <typename S>
+void block_moments(int factors,
+                   Ref<Matrix<S, Dynamic, Dynamic> const> C,
+                   Ref<Matrix<S, Dynamic, Dynamic> const> B,
+                   Ref<Matrix<S, Dynamic, 1> const> D,
+                   Ref<Matrix<S, Dynamic, 1> const> mean,
+                   Ref<Matrix<S, Dynamic, Dynamic> const> W,
+                   Matrix<S, Dynamic, Dynamic> & CW,
+                   Ref<RowVectorXd> var, Ref<RowVectorXd> mu)
+{
+	int nb = W.cols();
+	if (factors == 0) {
+		CW.leftCols(nb).noalias() = C * W;
+		var = (W.array() * CW.leftCols(nb).array()).colwise().sum().template cast<double>();
+	} else {
+		CW.leftCols(nb).noalias() = B.transpose() * W;
+		var = (CW.leftCols(nb).colwise().squaredNorm() + D.transpose() * W.cwiseAbs2()).template cast<double>();
+	}
+	mu = (mean.transpose() * W).template cast<double>();
+}
+
+/*
+ * block_moments() for exactly K securities and a dense C, on fixed size matrices:
+ * the products are unrolled at compile time and each portfolio stays in registers,
+ * where the dynamic size kernel spends more on loop and call overhead than on
+ * arithmetic. Used for 2 <= K <= FIXED_MAX, see fixed_kernels.
+ */
+#define FIXED_MAX 16
+
+template <int K>
+void block_moments_fixed(Ref<MatrixXd const> C, Ref<VectorXd const> mean, Ref<MatrixXd const> W,
+                         Ref<RowVectorXd> var, Ref<RowVectorXd> mu)
+{
+	Matrix<double, K, K> const Ck = C;
+	Matrix<double, K, 1> const mk = mean;
+	for (int j = 0; j < W.cols(); j++) {
+		Matrix<double, K, 1> const w = W.col(j);
+		var[j] = w.dot(Ck * w);
+		mu[j] = mk.dot(w);
+	}
+}
+
+typedef void (*fixed_kernel)(Ref<MatrixXd const>, Ref<VectorXd const>, Ref<MatrixXd const>,
+                             Ref<RowVectorXd>, Ref<RowVectorXd>);
+
+/* fixed_kernels[k] is block_moments_fixed<k>, or NULL if there is none */
+static fixed_kernel const fixed_kernels[FIXED_MAX + 1] = {
+	NULL, NULL,
+	block_moments_fixed<2>,  block_moments_fixed<3>,  block_moments_fixed<4>,
+	block_moments_fixed<5>,  block_moments_fixed<6>,  block_moments_fixed<7>,
+	block_moments_fixed<8>,  block_moments_fixed<9>,  block_moments_fixed<10>,
+	block_moments_fixed<11>, block_moments_fixed<12>, block_moments_fixed<13>,
+	block_moments_fixed<14>, block_moments_fixed<15>, block_moments_fixed<16>,
+};
+
+/*
+ * R = returns matrix
+ * cv = covariance matrix, of which the first mean_returns.size() securities are used
+ * mean_returns = vector of the average returns for each security
+ * opts = number of simulations, and how many to evaluate at once
+ * min_return = lower bound (measured in dollars) of the desired account value
+ * init_capital = the initial capital after accounting for transaction costs of purchasing the securities
+ * 'weights', 'variances', and 'returns' are output parameters containing the results of the simulation
+ *
+ * Returns the index [0,n) corresponding with the set of parameters for which the
+ * minimum return was satisfied and the variance was minimized.
+ * If there are no feasible solutions, -1 is returned.
+ * If opts asks for SAMPLE_SOBOL, and opts.qmc has fewer dimensions than there are
+ * securities, -2 is returned.
+ */
+int run(Ref<MatrixXd const> R, cov_model const & cv, Ref<VectorXd const> mean_returns,
+         sim_options const & opts, double min_return, double init_capital,
+	 vector<VectorXd> *weights,
+	 vector<double> *variances,
+	 vector<double> *returns)
+{
+	if (init_capital < 0) {
+		return -1;
+	}
+	int n;
+	int ncol;
+	int nsim = opts.nsim;
+	vector<topk> kept;  /* per-thread best portfolios, with opts.topk */
+	ncol = mean_returns.size(); /* number of columns, or stocks/variables in dataset */
+	if (opts.sampler == SAMPLE_SOBOL && (!opts.qmc || opts.qmc->dims < ncol)) {
+		return -2;
+	}
+	/* a few securities, with a dense C: use the fixed size kernel, in double precision */
+	fixed_kernel fixed = (cv.factors == 0 && ncol <= FIXED_MAX) ? fixed_kernels[ncol] : NULL;
+	int single = opts.precision == PRECISION_FLOAT && !fixed;
+#pragma omp parallel
+	{
+		if (omp_get_thread_num() == 0)
+			n = omp_get_num_threads();
+	}
+#pragma omp barrier
+	if (opts.topk > 0) {
+		kept.resize(n);
+	}
+	/* with PRECISION_FLOAT, single precision copies of the covariance and mean returns,
+	 * so the products in block_moments() move half the bytes and do twice the flops per instruction */
+	MatrixXf Cf, Bf;
+	VectorXf Df, meanf;
+	if (single) {
+		if (cv.factors == 0) {
+			Cf = cv.C.topLeftCorner(ncol, ncol).cast<float>();
+		} else {
+			Bf = cv.B.topRows(ncol).cast<float>();
+			Df = cv.D.head(ncol).cast<float>();
+		}
+		meanf = mean_returns.cast<float>();
+	}
+
+#pragma omp parallel num_threads(n)
+	{
+		/* collecting stats, tl stands for 'thread-local'
+		 * we will aggregate all these together in 3 vectors, and report
+		 * our findings to the main thread after all these threads finish simulation.
+		 * With opts.topk, each thread only keeps its best opts.topk portfolios, in
+		 * kept[tid], so memory does not grow with the number of simulations.
+		 */ 
+		vector<VectorXd> tl_weights;
+		vector<double> tl_returns;
+		vector<double> tl_variances;
+		int tid = omp_get_thread_num();
+		int block = opts.block;
+		int nblocks = (nsim + block - 1) / block;
+
+		if (opts.topk > 0) {
+			topk_init(&kept[tid], ncol, opts.topk);
+		}
+
+		/* portfolios are simulated 'block' at a time: the columns of W are the weights
+		 * of 'block' portfolios, so that C * W is one matrix-matrix product (which
+		 * reuses each element of C 'block' times) instead of 'block' matrix-vector products.
+		 * the variance of portfolio j is then the dot product of W.col(j) and CW.col(j).
+		 * with a factor model, it is |B^T W.col(j)|^2 + sum(D W.col(j)^2) instead, one
+		 * (factors x ncol) by (ncol x block) product per block
+		 *
+		 * the random weights of portfolio number t (of nsim) depend only on opts.seed,
+		 * t, and the number of stocks (which tells apart the calls made by optimize()),
+		 * and blocks are always the same 'block' portfolios, whichever thread runs them.
+		 * so a given seed gives the same portfolios for any number of threads.
+		 */
+		MatrixXd W(ncol, block);  /* one weight per security, per portfolio */
+		MatrixXd CW;
+		MatrixXf Wf, CWf;
+		if (single) {
+			Wf.resize(ncol, block);
+			CWf.resize(cv.factors ? cv.factors : ncol, block);
+		} else {
+			CW.resize(cv.factors ? cv.factors : ncol, block);
+		}
+		RowVectorXd var(block);
+		RowVectorXd mu(block);
+
+#pragma omp for schedule(static)
+		for (int b = 0; b < nblocks; b++) {
+			int nb = MIN(block, nsim - b * block);
+			/* make some random weights, that sum up to one */
+			if (opts.sampler == SAMPLE_SOBOL) {
+				sobol_block(opts.qmc, opts.seed, ncol, (uint64_t) b * block, nb, ncol, W.data());
+			} else {
+				simplex_block(opts.seed, ncol, (uint64_t) b * block, nb, ncol, opts.sampler, W.data());
+			}
+			/* finally, compute the parameters (variance and mean) for these portfolios.
+			 * we only care to remember the parameters for which the resulting account value
+			 * is greater than or equal to the minimum account value specified */
+			if (fixed) {
+				fixed(cv.C.topLeftCorner(ncol, ncol), mean_returns, W.leftCols(nb),
+				      var.head(nb), mu.head(nb));
+			} else if (single) {
+				Wf.leftCols(nb) = W.leftCols(nb).cast<float>();
+				block_moments<float>(cv.factors, Cf, Bf, Df, meanf, Wf.leftCols(nb), CWf,
+				                     var.head(nb), mu.head(nb));
+			} else if (cv.factors == 0) {
+				block_moments<double>(0, cv.C.topLeftCorner(ncol, ncol), cv.B, cv.D, mean_returns,
+				                      W.leftCols(nb), CW, var.head(nb), mu.head(nb));
+			} else {
+				block_moments<double>(cv.factors, cv.C, cv.B.topRows(ncol), cv.D.head(ncol), mean_returns,
+				                      W.leftCols(nb), CW, var.head(nb), mu.head(nb));
+			}
+			for (int j = 0; j < nb; j++) {
+				if (((mu[j] + 1) * init_capital) < min_return) {
+					continue;
+				}
+				if (opts.topk > 0) {
+					topk_push(&kept[tid], W.col(j), var[j], mu[j]);
+				} else {
+					tl_weights.push_back(W.col(j));
+					tl_variances.push_back(var[j]);
+					tl_returns.push_back(mu[j]);
+				}
+			}
+		}
+		if (opts.topk > 0) {
+			/* tree reduction: in round 'stride', thread tid merges in the portfolios
+			 * of thread tid + stride, until thread 0 holds the best of all of them */
+			for (int stride = 1; stride < n; stride *= 2) {
+#pragma omp barrier
+				if (tid % (2 * stride) == 0 && tid + stride < n)
+					topk_merge(&kept[tid], kept[tid + stride]);
+			}
+			if (tid == 0) {
+				for (int slot : kept[0].heap) {
+					weights->push_back(kept[0].w.col(slot));
+					variances->push_back(kept[0].var[slot]);
+					returns->push_back(kept[0].mu[slot]);
+				}
+			}
+		}
+		/* 'move iterators' will call the move constructor when copying the thread_local
+		 * parameters back to the main thread. using the move constructor avoids deep copy of data.
+		 */
+#pragma omp critical
+		{
+			weights->insert(weights->end(), make_move_iterator(tl_weights.begin()),
+			                                make_move_iterator(tl_weights.end()));
+			variances->insert(variances->end(), tl_variances.begin(), tl_variances.end());
+			returns->insert(returns->end(),     tl_returns.begin(), tl_returns.end());
+		}
+	}
+#pragma omp barrier
+	// printf("Finished simulation with %d stocks\n", ncol);
+	if (single && !variances->empty()) {
+		/* the portfolios were only compared in single precision: recompute the ones
+		 * that come within 0.1% of the least variance in double, and choose among those.
+		 * a recomputed variance can rise above one that was not recomputed, so repeat
+		 * until the least variance is itself a double one.
+		 * if single precision was further off than 0.1%, the choice may be wrong */
+		static int warned = 0;
+		vector<char> exact(variances->size());
+		double err = 0;
+		for (;;) {
+			auto least = min_element(variances->begin(), variances->end());
+			if (*least == HUGE_VAL || exact[least - variances->begin()]) {
+				break;
+			}
+			double band = *least + 1e-3 * fabs(*least);
+			for (size_t j = 0; j < variances->size(); j++) {
+				if (exact[j] || (*variances)[j] > band) {
+					continue;
+				}
+				VectorXd const & w = (*weights)[j];
+				double v = cov_quad(cv, w);
+				double r = mean_returns.dot(w);
+				err = MAX(err, fabs(v - (*variances)[j]) / MAX(fabs(v), 1e-300));
+				(*variances)[j] = ((r + 1) * init_capital < min_return) ? HUGE_VAL : v;
+				(*returns)[j] = r;
+				exact[j] = 1;
+			}
+		}
+		int seen = 1;
+		if (err > 1e-3) {
+			/* several threads of main's -f loop may get here at once */
+#pragma omp atomic capture
+			seen = warned++;
+		}
+		if (seen == 0) {
+			warn("Single precision variances are off by %.2g%% with %d stocks, try -P double\n",
+			     100 * err, ncol);
+		}
+	}
+	auto found = min_element(variances->begin(), variances->end());
+	if (found == variances->end() || *found == HUGE_VAL) {
+		return -1;
+	}
+	return found - variances->begin();
+}
+
+/*
+ * qp_solve
+ *   the exact minimum variance portfolio, found with a primal active-set method:
+ *     minimize   w^T C w
+ *     subject to sum(w) = 1, w >= 0, and
+ *                (mean_returns^T w + 1) * init_capital >= min_return  (the feasibility test of run())
+ *   Each iteration solves the problem with the working set of constraints held as
+ *   equalities, on the securities whose weight is not fixed at 0, then either steps
+ *   towards that solution (stopping at the first constraint it would cross) or,
+ *   if already there, frees the constraint with the most negative multiplier.
+ *   If 'w' holds a feasible portfolio it is used as the starting point, which makes
+ *   re-solving after removing a security cheap. On return it holds the solution.
+ *   returns 0, -1 if no portfolio is feasible, or -2 if the method did not converge
+ *   in 10 * k + 100 iterations (then w is feasible, but may not be optimal)
+ */
+int qp_solve(cov_model const & cv, Ref<VectorXd const> mean_returns,
+             double min_return, double init_capital, VectorXd *w)
+{
+	int k = mean_returns.size();
+	if (init_capital <= 0 || k == 0) {
+		return -1;
+	}
+	Ref<VectorXd const> mu = mean_returns;
+	double r = min_return / init_capital - 1; /* the least feasible mean return */
+	int best;
+	if (mu.maxCoeff(&best) < r) {
+		return -1;
+	}
+	/* start from the given portfolio if it is feasible, else put everything in the best stock */
+	if (w->size() != k || w->minCoeff() < 0 || fabs(w->sum() - 1) > 1e-9 || mu.dot(*w) < r) {
+		w->setZero(k);
+		(*w)[best] = 1;
+	}
+	/* a tiny ridge keeps the reduced Hessian (or, with factors, D_F) invertible
+	 * when there are fewer weeks than securities */
+	double diag = (cv.factors == 0) ? cv.C.diagonal().head(k).mean()
+	            : (cv.B.topRows(k).squaredNorm() + cv.D.head(k).sum()) / k;
+	double ridge = 1e-12 * MAX(diag, 1e-300);
+	vector<char> isfree(k);
+	for (int i = 0; i < k; i++)
+		isfree[i] = (*w)[i] > 0;
+	bool ret_active = mu.dot(*w) - r <= 1e-12;
+
+	vector<int> F;
+	MatrixXd CFF, BF, DB, At, Q, Rr, CZ, H;
+	VectorXd a, b, wF, g, dinv, muF, c;
+	for (int iter = 0; iter < 10 * k + 100; iter++) {
+		F.clear();
+		for (int i = 0; i < k; i++)
+			if (isfree[i])
+				F.push_back(i);
+		int s = F.size();
+		muF.resize(s);
+		for (int j = 0; j < s; j++)
+			muF[j] = mu[F[j]];
+		/* the working set's equalities on F: A w_F = c, where A = [1 mu_F]^T and
+		 * c = (1, r) with the return constraint, else A = 1^T and c = 1 */
+		int m = ret_active ? 2 : 1;
+		At.resize(s, m);
+		At.col(0).setOnes();
+		c.resize(m);
+		c[0] = 1;
+		if (ret_active) {
+			At.col(1) = muF;
+			c[1] = r;
+		}
+		HouseholderQR<MatrixXd> qr(At);
+		Rr = qr.matrixQR().topRows(MIN(m, s)).triangularView<Upper>();
+		if (ret_active && (s < 2 || fabs(Rr(1, 1)) <= 1e-12 * muF.norm())) {
+			/* mu is the same for every free security, so the return constraint
+			 * holds for any weights on F that sum to one */
+			ret_active = false;
+			continue;
+		}
+
+		/* solution on F with the working set as equalities: C_FF w_F = l1 1 + l2 mu_F */
+		double l1, l2 = 0;
+		if (cv.factors == 0) {
+			/*
+			 * null space method: with [Y Z] the Q of A^T = QR, w_F = Y R^-T c + Z y
+			 * meets A w_F = c exactly for any y, and y minimizes (Z^T C_FF Z) y = -Z^T C_FF w0.
+			 * When there are fewer weeks than securities C_FF is singular, and a solve
+			 * with C_FF itself loses the constraints to rounding
+			 */
+			CFF.resize(s, s);
+			for (int j = 0; j < s; j++)
+				for (int i = 0; i < s; i++)
+					CFF(i, j) = cv.C(F[i], F[j]);
+			Q = qr.householderQ();
+			wF = Q.leftCols(m) * Rr.transpose().triangularView<Lower>().solve(c);
+			if (s > m) {
+				CZ = CFF * Q.rightCols(s - m);
+				H = Q.rightCols(s - m).transpose() * CZ;
+				H.diagonal().array() += ridge;   /* Z^T C_FF Z is singular too when T < k */
+				wF += Q.rightCols(s - m) * H.ldlt().solve(-(CZ.transpose() * wF));
+			}
+			/* the multipliers, by least squares: C_FF w_F = A^T (l1, l2) */
+			VectorXd lambda = Rr.triangularView<Upper>().solve(Q.leftCols(m).transpose() * (CFF * wF));
+			l1 = lambda[0];
+			if (ret_active)
+				l2 = lambda[1];
+		} else {
+			/* Woodbury: (D_F + B_F B_F^T)^-1 x = D_F^-1 x - D_F^-1 B_F (I + B_F^T D_F^-1 B_F)^-1 B_F^T D_F^-1 x,
+			 * which only factors a (factors x factors) matrix */
+			dinv.resize(s);
+			BF.resize(s, cv.B.cols());
+			for (int j = 0; j < s; j++) {
+				dinv[j] = 1 / (cv.D[F[j]] + ridge);
+				BF.row(j) = cv.B.row(F[j]);
+			}
+			DB = dinv.asDiagonal() * BF;
+			CFF = BF.transpose() * DB;
+			CFF.diagonal().array() += 1;
+			LDLT<MatrixXd> ldlt(CFF);
+			a = dinv - DB * ldlt.solve(DB.transpose() * VectorXd::Ones(s));  /* C_FF^-1 1 */
+			b = dinv.cwiseProduct(muF) - DB * ldlt.solve(DB.transpose() * muF);  /* C_FF^-1 mu */
+			if (ret_active) {
+				double m11 = a.sum(), m12 = b.sum(), m22 = muF.dot(b);
+				double det = m11 * m22 - m12 * m12;
+				if (fabs(det) <= 1e-12 * fabs(m11 * m22)) {
+					ret_active = false;
+					continue;
+				}
+				l1 = (m22 - r * m12) / det;
+				l2 = (r * m11 - m12) / det;
+				wF = l1 * a + l2 * b;
+			} else {
+				l1 = 1 / a.sum();
+				wF = l1 * a;
+			}
+			/* C_FF is only as well conditioned as D_F: put w_F back on A w_F = c */
+			wF += At * (At.transpose() * At).ldlt().solve(c - At.transpose() * wF);
+		}
+
+		VectorXd p(s);
+		for (int j = 0; j < s; j++)
+			p[j] = wF[j] - (*w)[F[j]];
+		if (p.lpNorm<Infinity>() <= 1e-12) {
+			/* optimal for this working set. the multiplier of w_i >= 0, for i not in F,
+			 * is the i'th element of the gradient C w - l1 1 - l2 mu */
+			if (cv.factors == 0) {
+				g.setZero(k);
+				for (int j = 0; j < s; j++)
+					g += cv.C.col(F[j]).head(k) * (*w)[F[j]];
+			} else {
+				/* w is 0 outside of F, so C(:, F) w_F = C w */
+				g = cv.B.topRows(k) * (cv.B.topRows(k).transpose() * *w) + cv.D.head(k).cwiseProduct(*w);
+			}
+			g -= VectorXd::Constant(k, l1) + l2 * mu;
+			/* multipliers are in units of variance: when a portfolio of (near) zero
+			 * variance meets the constraints, l1 and l2 are rounding noise of either sign */
+			double tol = 1e-10 * MAX(fabs(l1), diag);
+			int drop = -1;
+			double most = -tol;
+			for (int i = 0; i < k; i++) {
+				if (!isfree[i] && g[i] < most) {
+					most = g[i];
+					drop = i;
+				}
+			}
+			if (ret_active && l2 * mu.cwiseAbs().maxCoeff() < -tol) {
+				ret_active = false;
+				continue;
+			}
+			if (drop == -1) {
+				/* every multiplier is >= 0: w is optimal */
+				*w = w->cwiseMax(0.0);
+				*w /= w->sum();
+				return 0;
+			}
+			isfree[drop] = 1;
+			continue;
+		}
+
+		/* step towards wF, stopping at the first constraint we would cross */
+		double alpha = 1;
+		int block = -1;  /* index into F of the blocking bound, or -2 for the return constraint */
+		for (int j = 0; j < s; j++) {
+			if (p[j] < 0 && -(*w)[F[j]] / p[j] < alpha) {
+				alpha = -(*w)[F[j]] / p[j];
+				block = j;
+			}
+		}
+		double mp = muF.dot(p);
+		if (!ret_active && mp < 0 && (mu.dot(*w) - r) / -mp < alpha) {
+			alpha = MAX(0.0, (mu.dot(*w) - r) / -mp);
+			block = -2;
+		}
+		for (int j = 0; j < s; j++)
+			(*w)[F[j]] += alpha * p[j];
+		if (block >= 0) {
+			(*w)[F[block]] = 0;
+			isfree[F[block]] = 0;
+		} else if (block == -2) {
+			ret_active = true;
+		}
+	}
+	/* out of iterations: w is feasible, but not known to be optimal */
+	*w = w->cwiseMax(0.0);
+	*w /= w->sum();
+	return -2;
+}
+
+/* variances this close, relative to each other, are the same, see optimize() */
+#define VAR_RTOL 1e-9
+
+/*
+ * optimize
+ *   starting from every security, repeatedly simulate portfolios with run() and
+ *   remove the security with the least weight (or, if nothing was feasible, the
+ *   lowest expected return), until 2 securities are left.
+ *   returns the feasible portfolio with the least variance seen along the way,
+ *   with its tickers in the order they were given. Variances within VAR_RTOL of
+ *   each other (relative) count as equal, and the later portfolio, with fewer
+ *   securities, is kept: this is for both engines, see the comparison below.
+ *   For ENGINE_QP, if 'warm' is not NULL, it is the starting point of the first
+ *   solve (with every security), and on return holds that solve's solution.
+ *
+ *   The securities still in play are the first m of R, cv, mean_returns and tickers,
+ *   and run() and qp_solve() see the top left m x m corner of cv.C (or the first m
+ *   rows of cv.B and cv.D), without copying.
+ *   Removing security i swaps it with security m - 1 (O(m) data movement, where
+ *   erasing it would shift O(m^2)), and cv and R are only compacted once m has
+ *   halved, so their columns stay close together in memory.
+ */
+portfolio optimize(MatrixXd R, cov_model cv, VectorXd mean_returns, vector<string> tickers,
+                   double initial_capital, double min_return, double tcost,
+                   sim_options const & opts, VectorXd *warm)
+{
+	portfolio best;
+	best.nstocks = -1;
+	best.variance = 10000000.0;
+
+	/* FIXME: eliminate any variables with a negative mean-return */
+	vector<VectorXd> weights;
+	vector<double> variances;
+	vector<double> returns;
+	VectorXd w;  /* for ENGINE_QP: the last solution, less the removed security */
+	if (warm) {
+		w = *warm;
+	}
+	int m = mean_returns.size();  /* number of securities still in play */
+	int all = m;
+	vector<int> pos(m);        /* pos[j] = index of security j in the arguments */
+	for (int j = 0; j < m; j++) {
+		pos[j] = j;
+	}
+	/* index of the least of v[0..m), the first one in the given order if tied */
+	auto least = [&](double const *v) {
+		int at = 0;
+		for (int j = 1; j < m; j++) {
+			if (v[j] < v[at] || (v[j] == v[at] && pos[j] < pos[at]))
+				at = j;
+		}
+		return at;
+	};
+	while (m > 2) {
+		auto mu = mean_returns.head(m);
+		int i;
+		if (opts.engine == ENGINE_QP) {
+			i = qp_solve(cv, mu, (initial_capital * (min_return + 1)),
+			             initial_capital - (m * tcost), &w);
+			if (warm && m == all) {  /* the first solve, with every security */
+				*warm = w;
+			}
+			if (i == -2) {
+				/* feasible, so still a candidate, but it may not be the minimum */
+				warn("qp_solve did not converge with %d stocks\n", m);
+				i = 0;
+			}
+			if (i == 0) {
+				weights.push_back(w);
+				variances.push_back(cov_quad(cv, w));
+				returns.push_back(w.dot(mu));
+			}
+		} else {
+			i = run(R.leftCols(m), cv, mu, opts,
+			        (initial_capital * (min_return + 1)), initial_capital - (m * tcost),
+			        &weights, &variances, &returns);
+			if (i == -2) {
+				warn("The Sobol sequence has fewer dimensions than the %d stocks\n", m);
+				break;
+			}
+		}
+		if (i == -1) {
+			/* problem was infeasible, and no data recorded.
+			 * remove stock with the lowest expected return and try again.
+			 */
+			i = least(mu.data());
+		} else {
+			/* we found a feasible solution. if the variance of this solution is lesser than that
+			 * which we've seen so far, consider this to be a better solution.
+			 * Dropping a security the solution gave no weight leaves the same portfolio, whose
+			 * variance then differs only by rounding: within VAR_RTOL, the fewer stocks win, so
+			 * covariance matrices that differ in the last bit (cov() and the running moments
+			 * of -M) give the same answer. Two different portfolios (of ENGINE_MC, say) this
+			 * close are as good as each other, so the tolerance applies to them as well, rather
+			 * than only to the double precision recheck of PRECISION_FLOAT.
+			 */
+			if (variances[i] <= best.variance * (1 + VAR_RTOL)) {
+				vector<int> order(m);
+				for (int j = 0; j < m; j++) {
+					order[j] = j;
+				}
+				sort(order.begin(), order.end(), [&](int a, int b) { return pos[a] < pos[b]; });
+				best.nstocks = m;
+				best.weights.resize(m);
+				best.exp_returns.resize(m);
+				best.tickers.resize(m);
+				for (int j = 0; j < m; j++) {
+					best.weights[j] = weights[i][order[j]];
+					best.exp_returns[j] = mu[order[j]];
+					best.tickers[j] = tickers[order[j]];
+				}
+				best.variance = variances[i];
+			}
+			/* remove variable with the least weighting in this portfolio */
+			i = least(weights[i].data());
+		}
+		/* move security i to the end of the active set, and drop it */
+		m--;
+		if (i != m) {
+			if (cv.factors == 0) {
+				cv.C.col(i).head(m + 1).swap(cv.C.col(m).head(m + 1));
+				cv.C.row(i).head(m + 1).swap(cv.C.row(m).head(m + 1));
+			} else {
+				cv.B.row(i).swap(cv.B.row(m));
+				swap(cv.D[i], cv.D[m]);
+			}
+			R.col(i).swap(R.col(m));
+			swap(mean_returns[i], mean_returns[m]);
+			swap(tickers[i], tickers[m]);
+			swap(pos[i], pos[m]);
+			if (w.size() > m) {
+				swap(w[i], w[m]);
+			}
+		}
+		if (w.size() > m) {
+			w.conservativeResize(m);
+		}
+		if (2 * m <= R.cols() && m > 2) {
+			if (cv.factors == 0) {
+				cv.C = cv.C.topLeftCorner(m, m).eval();
+			} else {
+				cv.B = cv.B.topRows(m).eval();
+				cv.D = cv.D.head(m).eval();
+			}
+			R = R.leftCols(m).eval();
+		}
+
+		weights.clear();
+		variances.clear();
+		returns.clear();
+	}
+	return best;
+}
@@ -0,0 +1,116 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Minimum variance portfolios, by Monte Carlo simulation or quadratic programming
+ */
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "covariance.h"
+
+/* how optimize() finds portfolios */
+#define ENGINE_MC 0  /* Monte Carlo simulation, see run() */
+#define ENGINE_QP 1  /* exact solution, see qp_solve() */
+
+/* how run() draws random portfolios */
+#define SAMPLE_UNIFORM   0  /* uniform numbers, divided by their sum */
+#define SAMPLE_DIRICHLET 1  /* Dirichlet(1, ..., 1): uniformly distributed on the simplex */
+#define SAMPLE_SOBOL     2  /* like SAMPLE_DIRICHLET, from a scrambled Sobol sequence */
+
+/* the precision of the variances and mean returns computed by run() */
+#define PRECISION_DOUBLE 0
+#define PRECISION_FLOAT  1  /* the best portfolios are then recomputed in double */
+
+/*
+ * A Sobol sequence (I. M. Sobol', 1967) in 'dims' dimensions, with 32 bit
+ * direction numbers: point n is the xor of the direction numbers v[j][k]
+ * of dimension j for the bits k set in the Gray code of n.
+ * Dimension 0 is the van der Corput sequence; dimension j > 0 uses the j'th
+ * primitive polynomial over GF(2) (by degree, then value) with odd initial
+ * direction numbers drawn from a fixed philox4x32_10 key. The direction
+ * numbers are then scrambled with a random lower triangular matrix per
+ * dimension (J. Matousek, 1998), keyed by the seed, which keeps the
+ * sequence's equidistribution. A random digital shift per run() (see
+ * sobol_block()) makes every point uniformly distributed.
+ */
+struct sobol {
+	int dims;
+	std::vector<uint32_t> v;  /* v[32 * j + k]: direction number k of dimension j */
+};
+
+/* the number of portfolios run() simulates, and evaluates together, unless told otherwise */
+#define DEFAULT_NSIM 3000
+#define DEFAULT_BLOCK 64
+
+struct sim_options {
+	int engine;  /* ENGINE_MC or ENGINE_QP */
+	int nsim;    /* number of random portfolios */
+	int block;   /* number of portfolios drawn and evaluated together, see run() */
+	int topk;    /* if > 0, keep only this many feasible portfolios per thread, see run() */
+	uint64_t seed; /* key of the random number generator, see philox4x32_10() */
+	int sampler; /* SAMPLE_UNIFORM, SAMPLE_DIRICHLET or SAMPLE_SOBOL, see simplex_block() */
+	sobol const *qmc; /* for SAMPLE_SOBOL, see sobol_init() */
+	int precision; /* PRECISION_DOUBLE or PRECISION_FLOAT */
+};
+
+/* the defaults: ENGINE_MC with DEFAULT_NSIM portfolios in blocks of DEFAULT_BLOCK,
+ * SAMPLE_UNIFORM, PRECISION_DOUBLE, seed 0, and every portfolio kept */
+void sim_options_init(sim_options *opts);
+/* build the scrambled direction numbers of 'dims' dimensions, under 'seed' */
+void sobol_init(sobol *s, int dims, uint64_t seed);
+/* fill the nb columns of W (n x nb) with the weights of portfolios first, ...,
+ * first + nb - 1 of simulation 'stream', under 'seed', drawn by 'sampler'
+ * (SAMPLE_UNIFORM or SAMPLE_DIRICHLET). simplex_block() takes the AVX2 kernel
+ * if the cpu has it, which gives the weights of simplex_block_scalar() bit for bit */
+void simplex_block(uint64_t seed, uint32_t stream, uint64_t first,
+                   int nb, int n, int sampler, double *W);
+void simplex_block_scalar(uint64_t seed, uint32_t stream, uint64_t first,
+                          int nb, int n, int sampler, double *W);
+
+/* simulate opts.nsim random portfolios of the securities of R. returns the index
+ * of the feasible one with the least variance, -1 if none is feasible, or -2 if
+ * opts.sampler is SAMPLE_SOBOL and opts.qmc has fewer dimensions than R has columns */
+int run(Eigen::Ref<Eigen::MatrixXd const> R, cov_model const & cv, Eigen::Ref<Eigen::VectorXd const> mean_returns,
+        sim_options const & opts, double min_return, double init_capital,
+        std::vector<Eigen::VectorXd> *weights,
+        std::vector<double> *variances,
+        std::vector<double> *returns);
+
+/* the exact minimum variance portfolio, into *w. returns 0, -1 if no portfolio is feasible,
+ * or -2 if the active set method ran out of iterations: *w is then feasible, not optimal */
+int qp_solve(cov_model const & cv, Eigen::Ref<Eigen::VectorXd const> mean_returns,
+             double min_return, double init_capital, Eigen::VectorXd *w);
+
+/* the best portfolio found by optimize() */
+struct portfolio {
+	int nstocks;             /* -1 if no feasible portfolio was found */
+	std::vector<std::string> tickers;
+	Eigen::VectorXd weights;
+	Eigen::VectorXd exp_returns;    /* mean return of each of the tickers */
+	double variance;
+};
+
+/*
+ * the feasible portfolio with the least variance of any subset of the securities
+ * (the columns of R, one week of returns per row), or nstocks == -1 if there is none.
+ * Of portfolios whose variances agree to within 1e-9 (relative), the one with fewer
+ * securities is returned. 'warm' is NULL, or a starting point for ENGINE_QP, see the definition
+ */
+portfolio optimize(Eigen::MatrixXd R, cov_model cv, Eigen::VectorXd mean_returns, std::vector<std::string> tickers,
+                   double initial_capital, double min_return, double tcost,
+                   sim_options const & opts, Eigen::VectorXd *warm);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: The portfolio library (libportfolio.a): everything main, getstock, mkstore
+ *           and cov are built from, for use by other programs in the same process.
+ *
+ *   pricestore.h  binary price stores, and parsing CSV data as it arrives
+ *   ingest.h      CSV files or a price store -> price_panel
+ *   returns.h     price_panel -> weekly returns
+ *   covariance.h  returns -> covariance: dense, factor model, running and rolling
+ *   optimize.h    returns and covariance -> minimum variance portfolio
+ *   fetch.h       Quandl -> database directory of CSV files (link with -lcurl)
+ *   util.h        die, warn, upper, dates
+ *
+ * A program with prices of its own fills in a price_panel and starts from weeklyReturns().
+ */
+#ifndef PORTFOLIO_H
+#define PORTFOLIO_H
+
+#include "pricestore.h"
+#include "util.h"
+#include "ingest.h"
+#include "returns.h"
+#include "covariance.h"
+#include "optimize.h"
+#include "fetch.h"
+
+#endif
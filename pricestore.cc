@@ -0,0 +1,585 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Binary columnar price store, and the CSV parser that fills it (see pricestore.h)
+ */
+#include <errno.h>
+#include <math.h>      /* NAN, isnan, llround */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>    /* strtod */
+#include <string.h>
+#include <strings.h>   /* strncasecmp */
+#include <fcntl.h>     /* open */
+#include <unistd.h>    /* close */
+#include <sys/mman.h>  /* mmap, munmap, madvise */
+#include <sys/stat.h>  /* fstat */
+
+#include <algorithm>   /* sort, unique, lower_bound */
+#include <string>
+#include <vector>
+
+#include "pricestore.h"
+
+/*
+ * days_from_civil(2018, 1, 2) = number of days between 1970-01-01 and 2018-01-02
+ * see http://howardhinnant.github.io/date_algorithms.html
+ */
+static int32_t days_from_civil(int y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int32_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned) (y - era * 400);
+	unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int32_t) doe - 719468;
+}
+
+/*
+ * Parse a date of the form YYYY-mm-dd into *day (see days_from_civil).
+ * Returns a pointer to the first character after the date, or NULL if 's'
+ * does not start with a valid date.
+ * This runs once per CSV row, so unlike strptime(3)/mktime(3) it never touches
+ * the locale or timezone, and never allocates.
+ */
+char const *parse_date(char const *s, int32_t *day)
+{
+	static unsigned char const mdays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	unsigned v[8];
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		if (i == 4 || i == 7) {
+			if (s[i] != '-')
+				return NULL;
+			continue;
+		}
+		unsigned digit = (unsigned) (s[i] - '0');
+		if (digit > 9)
+			return NULL;
+		v[i - (i > 4) - (i > 7)] = digit;
+	}
+	int y = v[0] * 1000 + v[1] * 100 + v[2] * 10 + v[3];
+	unsigned m = v[4] * 10 + v[5];
+	unsigned d = v[6] * 10 + v[7];
+	if (m < 1 || m > 12 || d < 1 || d > mdays[m - 1])
+		return NULL;
+	if (m == 2 && d == 29 && (y % 4 != 0 || (y % 100 == 0 && y % 400 != 0)))
+		return NULL;
+	*day = days_from_civil(y, m, d);
+	return s + 10;
+}
+
+static size_t store_align(size_t n)
+{
+	return (n + STORE_ALIGN - 1) / STORE_ALIGN * STORE_ALIGN;
+}
+
+char const *store_ticker(price_store const *s, int i)
+{
+	return s->tickers + (size_t) i * STORE_TICKER_LEN;
+}
+
+double const *store_column(price_store const *s, int i)
+{
+	return s->prices + (size_t) i * s->ndates;
+}
+
+/* binary search for 'ticker' (upper case). returns its column, or -1 */
+int store_find(price_store const *s, char const *ticker)
+{
+	int lo = 0, hi = s->ntickers;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		int c = strncmp(store_ticker(s, mid), ticker, STORE_TICKER_LEN);
+		if (c == 0)
+			return mid;
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+static double const store_pow10[STORE_MAX_SCALE + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8
+};
+
+static void store_put_varint(std::string *out, int64_t v)
+{
+	uint64_t u = ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);  /* zigzag: small magnitudes, few bytes */
+	while (u >= 0x80) {
+		out->push_back((char) (u | 0x80));
+		u >>= 7;
+	}
+	out->push_back((char) u);
+}
+
+/* read a varint at p into *v. returns the byte after it, or NULL if it runs past 'end' */
+static unsigned char const *store_get_varint(unsigned char const *p, unsigned char const *end, int64_t *v)
+{
+	uint64_t u = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		unsigned char b = *p++;
+		u |= (uint64_t) (b & 0x7F) << shift;
+		if (b < 0x80) {
+			*v = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/* the smallest scale at which every price in 'col' (but NaNs) is an exact integer, or -1 */
+static int store_decimal_scale(double const *col, size_t n)
+{
+	for (int scale = 0; scale <= STORE_MAX_SCALE; scale++) {
+		double p = store_pow10[scale];
+		size_t i;
+		for (i = 0; i < n; i++) {
+			double v = col[i];
+			if (isnan(v))
+				continue;
+			if (!(fabs(v) * p < 9e15))  /* integers this size are exact in a double */
+				break;
+			double back = (double) llround(v * p) / p;
+			if (memcmp(&back, &v, sizeof v) != 0)
+				break;
+		}
+		if (i == n)
+			return scale;
+	}
+	return -1;
+}
+
+/* append the block of a column of 'n' prices to 'out' */
+static void store_encode_column(double const *col, size_t n, std::string *out)
+{
+	int scale = store_decimal_scale(col, n);
+	if (scale == -1) {
+		out->push_back(STORE_COL_RAW);
+		out->append((char const *) col, n * sizeof(double));
+		return;
+	}
+	int missing = 0;
+	for (size_t i = 0; i < n; i++)
+		missing |= isnan(col[i]);
+	out->push_back((char) (STORE_COL_DECIMAL | (missing ? STORE_COL_MISSING : 0)));
+	out->push_back((char) scale);
+	if (missing) {
+		std::string bits((n + 7) / 8, '\0');
+		for (size_t i = 0; i < n; i++) {
+			if (!isnan(col[i]))
+				bits[i / 8] |= (char) (1 << (i % 8));
+		}
+		out->append(bits);
+	}
+	int64_t prev = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (isnan(col[i]))
+			continue;
+		int64_t v = llround(col[i] * store_pow10[scale]);
+		store_put_varint(out, v - prev);
+		prev = v;
+	}
+}
+
+/* decode the column block [p, end) into 'n' prices. returns 0, or -1 if it is not valid */
+static int store_decode_column(unsigned char const *p, unsigned char const *end, double *col, size_t n)
+{
+	if (p >= end)
+		return -1;
+	int mode = *p++;
+	if (mode == STORE_COL_RAW) {
+		if ((size_t) (end - p) != n * sizeof(double))
+			return -1;
+		memcpy(col, p, n * sizeof(double));
+		return 0;
+	}
+	if ((mode & ~STORE_COL_MISSING) != STORE_COL_DECIMAL || p >= end || *p > STORE_MAX_SCALE)
+		return -1;
+	double scale = store_pow10[*p++];
+	unsigned char const *bits = NULL;
+	if (mode & STORE_COL_MISSING) {
+		if ((size_t) (end - p) < (n + 7) / 8)
+			return -1;
+		bits = p;
+		p += (n + 7) / 8;
+	}
+	int64_t v = 0, d;
+	for (size_t i = 0; i < n; i++) {
+		if (bits && !(bits[i / 8] >> (i % 8) & 1)) {
+			col[i] = NAN;
+			continue;
+		}
+		p = store_get_varint(p, end, &d);
+		if (!p)
+			return -1;
+		v += d;
+		col[i] = (double) v / scale;
+	}
+	return (p == end) ? 0 : -1;
+}
+
+/*
+ * decode the compressed store mapped at s->base (see the layout at the top) into
+ * s->decoded, and point s->dates, s->tickers and s->prices there.
+ * returns 0, or -1 if it is not a valid store
+ */
+static int store_decode(price_store *s)
+{
+	store_header const *hdr = (store_header const *) s->base;
+	unsigned char const *base = (unsigned char const *) s->base;
+	size_t nd = hdr->ndates, nt = hdr->ntickers;
+
+	if (hdr->dates_offset > hdr->tickers_offset ||
+	    hdr->tickers_offset + (uint64_t) nt * STORE_TICKER_LEN > hdr->prices_offset ||
+	    hdr->prices_offset + (uint64_t) (nt + 1) * sizeof(uint64_t) > s->size)
+		return -1;
+	/* prices first, so they stay 8-byte aligned */
+	s->decoded = malloc(nt * nd * sizeof(double) + nd * sizeof(int32_t) + nt * STORE_TICKER_LEN + 1);
+	if (!s->decoded)
+		return -1;
+	double *prices = (double *) s->decoded;
+	int32_t *dates = (int32_t *) (prices + nt * nd);
+	char *tickers = (char *) (dates + nd);
+
+	unsigned char const *p = base + hdr->dates_offset;
+	unsigned char const *end = base + hdr->tickers_offset;
+	int64_t day = 0, d;
+	for (size_t i = 0; i < nd; i++) {
+		p = store_get_varint(p, end, &d);
+		if (!p)
+			return -1;
+		day += d;
+		dates[i] = (int32_t) day;
+	}
+	memcpy(tickers, base + hdr->tickers_offset, nt * STORE_TICKER_LEN);
+	/* the column offsets follow the variable length dates, so they may be unaligned */
+	unsigned char const *columns = base + hdr->prices_offset;
+	uint64_t from, to;
+	memcpy(&to, columns, sizeof to);
+	for (size_t j = 0; j < nt; j++) {
+		from = to;
+		memcpy(&to, columns + (j + 1) * sizeof to, sizeof to);
+		if (from > to || to > s->size ||
+		    store_decode_column(base + from, base + to, prices + j * nd, nd) == -1)
+			return -1;
+	}
+	s->dates   = dates;
+	s->tickers = tickers;
+	s->prices  = prices;
+	return 0;
+}
+
+/*
+ * map the store at 'path' read-only.
+ * returns 0 on success, -1 if the file could not be mapped or is not a valid store
+ */
+int store_open(char const *path, price_store *s)
+{
+	struct stat st;
+	store_header const *hdr;
+	int fd;
+
+	memset(s, 0, sizeof *s);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof *hdr) {
+		close(fd);
+		return -1;
+	}
+	s->size = st.st_size;
+	s->base = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s->base == MAP_FAILED) {
+		s->base = NULL;
+		return -1;
+	}
+	hdr = (store_header const *) s->base;
+	if (memcmp(hdr->magic, STORE_MAGIC_Z, sizeof hdr->magic) == 0 && hdr->version == STORE_VERSION) {
+		/* compressed: decode it, and the mapping is not needed after that */
+		madvise(s->base, s->size, MADV_SEQUENTIAL);
+		s->ntickers = hdr->ntickers;
+		s->ndates   = hdr->ndates;
+		int ok = store_decode(s) == 0;
+		munmap(s->base, s->size);
+		s->base = NULL;
+		if (!ok) {
+			free(s->decoded);
+			memset(s, 0, sizeof *s);
+			errno = EINVAL;
+			return -1;
+		}
+		return 0;
+	}
+	if (memcmp(hdr->magic, STORE_MAGIC, sizeof hdr->magic) != 0 ||
+	    hdr->version != STORE_VERSION ||
+	    hdr->dates_offset   + (uint64_t) hdr->ndates * sizeof(int32_t) > s->size ||
+	    hdr->tickers_offset + (uint64_t) hdr->ntickers * STORE_TICKER_LEN > s->size ||
+	    hdr->prices_offset  + (uint64_t) hdr->ntickers * hdr->ndates * sizeof(double) > s->size) {
+		munmap(s->base, s->size);
+		memset(s, 0, sizeof *s);
+		return -1;
+	}
+	madvise(s->base, s->size, MADV_WILLNEED);
+	s->ntickers = hdr->ntickers;
+	s->ndates   = hdr->ndates;
+	s->dates    = (int32_t const *) ((char const *) s->base + hdr->dates_offset);
+	s->tickers  = (char const *) s->base + hdr->tickers_offset;
+	s->prices   = (double const *) ((char const *) s->base + hdr->prices_offset);
+	return 0;
+}
+
+void store_close(price_store *s)
+{
+	if (s->base)
+		munmap(s->base, s->size);
+	free(s->decoded);
+	memset(s, 0, sizeof *s);
+}
+
+/*
+ * write the series in 'all' (sorted by ticker, without duplicates) to a store at
+ * 'path', on the union of their dates, compressed if 'compress'. The store is
+ * written to a temporary file and renamed, so readers never see a partial store.
+ * returns 0, or -1 on error (see errno)
+ */
+int store_write(char const *path, std::vector<store_series> const & all, int compress)
+{
+	store_header hdr;
+	std::string tmp = std::string(path) + ".tmp";
+	std::vector<int32_t> dates;
+	FILE *file;
+	static char const zeros[STORE_ALIGN] = {0};
+
+	for (auto const & s : all)
+		dates.insert(dates.end(), s.dates.begin(), s.dates.end());
+	std::sort(dates.begin(), dates.end());
+	dates.erase(std::unique(dates.begin(), dates.end()), dates.end());
+	std::vector<double> column(dates.size());
+
+	std::string packed_dates;   /* compressed only */
+	std::string blocks;
+	std::vector<uint64_t> columns;
+	if (compress) {
+		int64_t prev = 0;
+		for (int32_t d : dates) {
+			store_put_varint(&packed_dates, d - prev);
+			prev = d;
+		}
+	}
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, compress ? STORE_MAGIC_Z : STORE_MAGIC, sizeof hdr.magic);
+	hdr.version        = STORE_VERSION;
+	hdr.ntickers       = all.size();
+	hdr.ndates         = dates.size();
+	hdr.dates_offset   = sizeof hdr;
+	if (compress) {
+		hdr.tickers_offset = hdr.dates_offset + packed_dates.size();
+		hdr.prices_offset  = hdr.tickers_offset + all.size() * STORE_TICKER_LEN;
+	} else {
+		hdr.tickers_offset = hdr.dates_offset + dates.size() * sizeof(int32_t);
+		hdr.prices_offset  = store_align(hdr.tickers_offset + all.size() * STORE_TICKER_LEN);
+	}
+
+	file = fopen(tmp.c_str(), "wb");
+	if (!file)
+		return -1;
+	fwrite(&hdr, sizeof hdr, 1, file);
+	if (compress)
+		fwrite(packed_dates.data(), 1, packed_dates.size(), file);
+	else
+		fwrite(dates.data(), sizeof(int32_t), dates.size(), file);
+	for (auto const & s : all) {
+		char name[STORE_TICKER_LEN];
+		memset(name, 0, sizeof name);
+		strncpy(name, s.ticker.c_str(), sizeof name);
+		fwrite(name, sizeof name, 1, file);
+	}
+	if (!compress)
+		fwrite(zeros, 1, hdr.prices_offset - (hdr.tickers_offset + all.size() * STORE_TICKER_LEN), file);
+	for (auto const & s : all) {
+		/* scatter this ticker's rows onto the shared date axis */
+		std::fill(column.begin(), column.end(), NAN);
+		if (!s.dates.empty()) {
+			size_t j = std::lower_bound(dates.begin(), dates.end(), s.dates.front()) - dates.begin();
+			for (size_t i = 0; i < s.dates.size(); i++) {
+				while (dates[j] < s.dates[i])
+					j++;
+				column[j] = s.prices[i];
+			}
+		}
+		if (compress) {
+			columns.push_back(blocks.size());
+			store_encode_column(column.data(), column.size(), &blocks);
+		} else {
+			fwrite(column.data(), sizeof(double), column.size(), file);
+		}
+	}
+	if (compress) {
+		/* the blocks start right after the column offsets */
+		uint64_t first = hdr.prices_offset + (all.size() + 1) * sizeof(uint64_t);
+		columns.push_back(blocks.size());
+		for (auto & c : columns)
+			c += first;
+		fwrite(columns.data(), sizeof(uint64_t), columns.size(), file);
+		fwrite(blocks.data(), 1, blocks.size(), file);
+	}
+	int failed = ferror(file);
+	if (fclose(file) != 0 || failed) {
+		remove(tmp.c_str());
+		return -1;
+	}
+	return rename(tmp.c_str(), path);
+}
+
+void csv_init(csv_parser *p, store_series *out)
+{
+	p->out = out;
+	p->partial.clear();
+	p->header = 0;
+	p->date_index = -1;
+	p->close_index = -1;
+	p->skipped = 0;
+	p->unordered = 0;
+}
+
+/* the field number 'index' of the line [s, end), or NULL */
+char const *csv_field(char const *s, char const *end, int index)
+{
+	for ( ; index > 0; index--) {
+		s = (char const *) memchr(s, ',', end - s);
+		if (!s)
+			return NULL;
+		s++;
+	}
+	return s;
+}
+
+/* index of the field 'name' in the header line [s, end), or -1 */
+int csv_column(char const *s, char const *end, char const *name)
+{
+	size_t len = strlen(name);
+	for (int index = 0; ; index++) {
+		char const *comma = (char const *) memchr(s, ',', end - s);
+		char const *e = comma ? comma : end;
+		char const *b = s;
+		while (b < e && (*b == ' ' || *b == '"'))
+			b++;
+		while (e > b && (e[-1] == ' ' || e[-1] == '"'))
+			e--;
+		if ((size_t) (e - b) == len && strncasecmp(b, name, len) == 0)
+			return index;
+		if (!comma)
+			return -1;
+		s = comma + 1;
+	}
+}
+
+/* parse the line [s, end). *end is a character that ends a number ('\n', '\r' or '\0') */
+static void csv_line(csv_parser *p, char const *s, char const *end)
+{
+	if (end > s && end[-1] == '\r')
+		end--;
+	if (!p->header) {
+		p->header = 1;
+		p->close_index = csv_column(s, end, "Adj. Close");
+		if (p->close_index == -1)
+			p->close_index = csv_column(s, end, "Close");
+		p->date_index = csv_column(s, end, "Date");
+		return;
+	}
+	if (s == end || p->date_index == -1 || p->close_index == -1)
+		return;
+	char const *d = csv_field(s, end, p->date_index);
+	char const *c = csv_field(s, end, p->close_index);
+	char *e;
+	int32_t day;
+	if (!d || !c || end - d < 10 || !parse_date(d, &day)) {
+		p->skipped++;
+		return;
+	}
+	double price = strtod(c, &e);
+	if (e == c || e > end) {
+		p->skipped++;
+		return;
+	}
+	if (!p->out->dates.empty() && day <= p->out->dates.back()) {
+		p->unordered++;
+		return;
+	}
+	p->out->dates.push_back(day);
+	p->out->prices.push_back(price);
+}
+
+void csv_feed(csv_parser *p, char const *buf, size_t len)
+{
+	char const *end = buf + len;
+	while (buf < end) {
+		char const *nl = (char const *) memchr(buf, '\n', end - buf);
+		if (!nl) {
+			p->partial.append(buf, end - buf);
+			return;
+		}
+		if (p->partial.empty()) {
+			csv_line(p, buf, nl);
+		} else {
+			p->partial.append(buf, nl - buf);
+			csv_line(p, p->partial.c_str(), p->partial.c_str() + p->partial.size());
+			p->partial.clear();
+		}
+		buf = nl + 1;
+	}
+}
+
+void csv_finish(csv_parser *p)
+{
+	if (!p->partial.empty()) {
+		csv_line(p, p->partial.c_str(), p->partial.c_str() + p->partial.size());
+		p->partial.clear();
+	}
+}
+
+/*
+ * parse the CSV file 'path' into 'out', with 'p', as csv_feed() parses a download:
+ * the one reader of CSV files into series, for mkstore and for getstock's cached files.
+ * returns 0, or -1 if the file cannot be opened (see errno)
+ */
+int csv_read_file(char const *path, csv_parser *p, store_series *out)
+{
+	char buf[1 << 16];
+	size_t n;
+
+	csv_init(p, out);
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return -1;
+	while ((n = fread(buf, 1, sizeof buf, file)) > 0) {
+		csv_feed(p, buf, n);
+	}
+	csv_finish(p);
+	fclose(file);
+	return 0;
+}
+
+/* why the series 's', parsed by 'p', cannot go in a store, or NULL if it can */
+char const *csv_unusable(csv_parser const *p, store_series const *s)
+{
+	if (!p->header)
+		return "no data";
+	if (p->close_index == -1 || p->date_index == -1)
+		return "no date and closing price fields";
+	if (s->dates.empty())
+		return "no price data";
+	return NULL;
+}
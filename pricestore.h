@@ -0,0 +1,163 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Binary columnar price store, written by mkstore and getstock and read by main,
+ *           and the CSV parser that fills it
+ */
+
+/*
+ * Layout of a store file (all integers little-endian, native doubles):
+ *
+ *   store_header
+ *   int32_t  dates[ndates]                      days since 1970-01-01, ascending
+ *   char     tickers[ntickers][STORE_TICKER_LEN] upper case, NUL padded, sorted
+ *   (padding up to a multiple of STORE_ALIGN)
+ *   double   prices[ntickers][ndates]           one contiguous column per ticker,
+ *                                               NaN where the ticker has no row for a date
+ *
+ * Every ticker shares the same date axis, so the price of ticker 'j' on dates[i]
+ * is prices[j * ndates + i]. The file is meant to be mmap(2)'d and read in place.
+ *
+ * A compressed store (magic STORE_MAGIC_Z) has the same header, then:
+ *
+ *   dates_offset:   varint (zigzag) differences between consecutive dates, from 0
+ *   tickers_offset: char     tickers[ntickers][STORE_TICKER_LEN]
+ *   prices_offset:  uint64_t columns[ntickers + 1]  file offsets of each column's
+ *                                                   block, and of the end of the last
+ *   then the column blocks, each a STORE_COL_* byte and its data (see store_encode_column)
+ *
+ * Prices written from CSV files have a few decimal places, so most columns are
+ * stored as integers (price * 10^scale) and each is a varint difference from the
+ * one before: two or three bytes a price instead of eight. store_open() decodes a
+ * compressed store into memory in one pass, and it is then read like any other.
+ *
+ * Stores are written by store_write(), from series parsed out of CSV data by
+ * csv_feed(), which getstock -s runs on downloads as they arrive, and csv_read_file()
+ * on files (for mkstore, and getstock's cached files).
+ */
+#ifndef PRICESTORE_H
+#define PRICESTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#define STORE_MAGIC      "PXSTORE1"
+#define STORE_MAGIC_Z    "PXSTOREZ"
+#define STORE_VERSION    1
+#define STORE_TICKER_LEN 16
+#define STORE_ALIGN      64
+
+/* encodings of a column block in a compressed store */
+#define STORE_COL_RAW     0     /* ndates native doubles */
+#define STORE_COL_DECIMAL 1     /* a scale byte, then varint differences of price * 10^scale */
+#define STORE_COL_MISSING 0x80  /* DECIMAL only: a bitmap of the dates with a price (bit i % 8
+                                 * of byte i / 8) comes before the differences */
+#define STORE_MAX_SCALE   8
+
+struct store_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t ntickers;
+	uint32_t ndates;
+	uint32_t reserved;
+	uint64_t dates_offset;
+	uint64_t tickers_offset;
+	uint64_t prices_offset;
+};
+
+/* a store that has been mapped into memory with store_open() */
+struct price_store {
+	void          *base;
+	size_t         size;
+	void          *decoded;  /* dates, tickers and prices of a compressed store */
+	int            ntickers;
+	int            ndates;
+	int32_t const *dates;
+	char const    *tickers;
+	double const  *prices;
+};
+
+/*
+ * Parse a date of the form YYYY-mm-dd into *day, the number of days since 1970-01-01.
+ * Returns a pointer to the first character after the date, or NULL if 's'
+ * does not start with a valid date.
+ * This runs once per CSV row, so unlike strptime(3)/mktime(3) it never touches
+ * the locale or timezone, and never allocates.
+ */
+char const *parse_date(char const *s, int32_t *day);
+
+/*
+ * map the store at 'path' read-only.
+ * returns 0 on success, -1 if the file could not be mapped or is not a valid store
+ */
+int store_open(char const *path, price_store *s);
+void store_close(price_store *s);
+/* the ticker of column 'i', NUL padded to STORE_TICKER_LEN */
+char const *store_ticker(price_store const *s, int i);
+/* the ndates prices of column 'i' */
+double const *store_column(price_store const *s, int i);
+/* binary search for 'ticker' (upper case). returns its column, or -1 */
+int store_find(price_store const *s, char const *ticker);
+
+/* the prices of one ticker, on its own (ascending) dates */
+struct store_series {
+	std::string ticker;
+	std::vector<int32_t> dates;
+	std::vector<double> prices;
+};
+
+/*
+ * write the series in 'all' (sorted by ticker, without duplicates) to a store at
+ * 'path', on the union of their dates, compressed if 'compress'. The store is
+ * written to a temporary file and renamed, so readers never see a partial store.
+ * returns 0, or -1 on error (see errno)
+ */
+int store_write(char const *path, std::vector<store_series> const & all, int compress);
+
+/*
+ * Incremental parser for the date and closing price columns of CSV data: a header
+ * line naming the columns (Date, and Adj. Close or else Close), then one row per day.
+ * csv_feed() takes the data in chunks of any size, as they are read or downloaded,
+ * and appends each row to 'out'. A line split between two chunks is kept in
+ * 'partial' until the rest of it arrives; csv_finish() parses a last line that
+ * has no newline.
+ */
+struct csv_parser {
+	store_series *out;
+	std::string partial;
+	int header;       /* 1 once the header line has been read */
+	int date_index;   /* column of the dates, -1 if there is none */
+	int close_index;  /* column of the closing prices, -1 if there is none */
+	long skipped;     /* rows without a valid date and price */
+	long unordered;   /* rows skipped because their date is not after the last row's */
+};
+
+void csv_init(csv_parser *p, store_series *out);
+/* parse the next 'len' bytes of the data */
+void csv_feed(csv_parser *p, char const *buf, size_t len);
+/* parse what is left of the data, at its end */
+void csv_finish(csv_parser *p);
+/* the field number 'index' of the line [s, end), or NULL */
+char const *csv_field(char const *s, char const *end, int index);
+/* index of the field 'name' in the header line [s, end), or -1 */
+int csv_column(char const *s, char const *end, char const *name);
+
+/*
+ * parse the CSV file 'path' into 'out', with 'p', as csv_feed() parses a download:
+ * the one reader of CSV files into series, for mkstore and for getstock's cached files.
+ * returns 0, or -1 if the file cannot be opened (see errno)
+ */
+int csv_read_file(char const *path, csv_parser *p, store_series *out);
+/* why the series 's', parsed by 'p', cannot go in a store, or NULL if it can */
+char const *csv_unusable(csv_parser const *p, store_series const *s);
+
+#endif /* PRICESTORE_H */
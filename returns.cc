@@ -0,0 +1,51 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Weekly returns of a price panel
+ */
+#include <Eigen/Core>
+
+#include "ingest.h"
+#include "returns.h"
+
+using namespace Eigen;
+
+/*
+ * Given n prices for a given security, write the n / 5 weekly returns
+ * for that security to 'returns'.
+ * We compute weekly returns as:
+ *    returns[i] = (p[5i + 4] - p[5i - 1]) / p[5i - 1],  0 < i < n / 5;
+ *    returns[0] = (p[4] - p[0]) / p[0]
+ * which is the change from one 5 day period's last close to the next one's,
+ * so every price move is in exactly one week (the move from a Friday to the
+ * following Monday included). The first week has no close before it, and
+ * starts from its own first price.
+ */
+void weeklyReturns(double const *prices, int n, double *returns)
+{
+	int i;
+
+	for (i = 0; i < n / 5; i++) {
+		double base = (i == 0) ? prices[0] : prices[5*i - 1];
+		returns[i] = (prices[5*i + 4] - base) / base;
+	}
+}
+
+/* the matrix of weekly returns of a panel, one column per ticker */
+MatrixXd weeklyReturns(price_panel const & panel)
+{
+	MatrixXd R;
+	int nrow = panel.prices.rows();
+
+	R.resize(nrow / 5, panel.prices.cols());
+	for (int j = 0; j < R.cols(); j++) {
+		weeklyReturns(panel.prices.col(j).data(), nrow, R.col(j).data());
+	}
+	return R;
+}
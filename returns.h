@@ -0,0 +1,26 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Weekly returns of a price panel
+ */
+#ifndef RETURNS_H
+#define RETURNS_H
+
+#include <Eigen/Core>
+
+#include "ingest.h"
+
+/* write the n / 5 weekly returns of n daily prices to 'returns': row i is the change
+ * from the last price of week i - 1 (the first price, for week 0) to the last of week i */
+void weeklyReturns(double const *prices, int n, double *returns);
+/* the matrix of weekly returns of a panel, one column per ticker. row i of it
+ * ends on panel.dates[5*i + 4] */
+Eigen::MatrixXd weeklyReturns(price_panel const & panel);
+
+#endif
@@ -0,0 +1,234 @@
+#!/bin/bash
+# Portfolio Optimization Project
+# Synopsis: end to end tests of the programs, run by 'make check'
+#
+# usage: tests/run.sh [BINDIR]   (BINDIR holds main, getstock, mkstore; default .)
+# the getstock tests need python3, for tests/server.py
+
+BIN=$(cd "${1:-.}" && pwd)
+SRC=$(cd "$(dirname "$0")" && pwd)
+T=$(mktemp -d)
+srv=
+trap '[ -n "$srv" ] && kill $srv; rm -rf "$T"' EXIT
+failed=0
+
+pass() { echo "PASS $1"; }
+fail() { echo "FAIL $1"; failed=1; }
+
+# expect NAME RC PATTERN: the last command exited with RC and its output ($T/out) matches PATTERN
+expect() {
+	if [ "$rc" -eq "$2" ] && grep -q "$3" "$T/out"; then
+		pass "$1"
+	else
+		fail "$1 (rc=$rc)"
+		sed 's/^/    /' "$T/out"
+	fi
+}
+
+# gen_csv FILE FIRST N SEED: N weekdays of prices from FIRST (YYYY-mm-dd)
+gen_csv() {
+	echo 'Date,Close,Volume' > "$1"
+	d=$2; i=0
+	while [ $i -lt "$3" ]; do
+		case $(date -u -d "$d" +%u) in
+		6|7) ;;
+		*) echo "$d,$(awk -v i=$i -v s="$4" 'BEGIN { printf "%.4f", 100 + s + 5 * sin(i * 0.3 * s) + 0.05 * i }'),1000" >> "$1"
+		   i=$((i + 1)) ;;
+		esac
+		d=$(date -u -d "$d + 1 day" +%Y-%m-%d)
+	done
+}
+
+# a file with no rows between the start and end dates is dropped, not read past its end
+printf 'Date,Close,Volume\n2019-01-02,1,2\n2019-01-03,1,2\n' > "$T/LATE.csv"
+printf '2018-01-01\n2018-06-01\n%s\n' "$T/LATE.csv" | "$BIN/main" -e qp > "$T/out" 2>&1
+rc=$?
+expect "main: only file is after the end date" 1 "Not enough price data"
+
+# ... and the other files are still used
+gen_csv "$T/AAA.csv" 2018-01-01 60 1
+gen_csv "$T/BBB.csv" 2018-01-01 60 2
+gen_csv "$T/CCC.csv" 2018-01-01 60 3
+printf '2018-01-01\n2018-06-01\n%s\n%s\n%s\n%s\n' "$T/LATE.csv" "$T/AAA.csv" "$T/BBB.csv" "$T/CCC.csv" |
+	"$BIN/main" -e qp -r 0.0001 > "$T/out" 2>&1
+rc=$?
+expect "main: a file after the end date is skipped" 0 "Optimal number of stocks"
+
+# main -s: a store, compressed (mkstore -z) or not, gives the answer of its CSV files
+mkdir "$T/csv"
+cp "$T/AAA.csv" "$T/BBB.csv" "$T/CCC.csv" "$T/csv"
+printf '2018-01-01\n2018-06-01\n%s\n%s\n%s\n' "$T/AAA.csv" "$T/BBB.csv" "$T/CCC.csv" | "$BIN/main" -e qp -r 0.0001 > "$T/full" 2>&1
+for z in "" -z; do
+	"$BIN/mkstore" $z -o "$T/prices$z.store" "$T/csv" > /dev/null 2>&1
+	printf '2018-01-01\n2018-06-01\nAAA\nBBB\nCCC\n' | "$BIN/main" -e qp -r 0.0001 -s "$T/prices$z.store" > "$T/out" 2>&1
+	if grep -q "Optimal number of stocks" "$T/out" && diff "$T/out" "$T/full" > /dev/null; then
+		pass "main -s: a store${z:+ written with -z} gives the portfolio of its CSV files"
+	else
+		fail "main -s: a store${z:+ written with -z} gives the portfolio of its CSV files"
+		diff "$T/out" "$T/full" | sed 's/^/    /'
+	fi
+done
+
+# main -M: adding weeks to a saved state gives the answer of a full recompute
+printf '2018-01-01\n2018-03-01\n%s\n%s\n%s\n' "$T/AAA.csv" "$T/BBB.csv" "$T/CCC.csv" > "$T/in_a"
+printf '2018-01-01\n2018-06-01\n%s\n%s\n%s\n' "$T/AAA.csv" "$T/BBB.csv" "$T/CCC.csv" > "$T/in_b"
+"$BIN/main" -e qp -r 0.0001 -M "$T/mom" < "$T/in_a" > /dev/null 2>&1
+"$BIN/main" -e qp -r 0.0001 -M "$T/mom" < "$T/in_b" > "$T/out" 2>&1
+rc=$?
+expect "main -M: adds the new weeks" 0 "Adding [0-9]* new weeks"
+grep -v "^Adding" "$T/out" > "$T/append"
+"$BIN/main" -e qp -r 0.0001 < "$T/in_b" > "$T/full" 2>&1
+if diff "$T/append" "$T/full" > /dev/null; then
+	pass "main -M: same portfolio as a full recompute"
+else
+	fail "main -M: same portfolio as a full recompute"
+	diff "$T/append" "$T/full" | sed 's/^/    /'
+fi
+
+# main -M: a saved state of 0 weeks (for the same tickers and start date) is rebuilt
+{
+	printf 'PXMOMNT1\x03\x00\x00\x00\x7c\x44\x00\x00\x00\x00\x00\x00'
+	printf '\x00\x00\x00\x00\x00\x00\x00\x00AAA\x00BBB\x00CCC\x00'
+	head -c 96 /dev/zero
+} > "$T/mom0"
+"$BIN/main" -e qp -r 0.0001 -M "$T/mom0" < "$T/in_b" > "$T/out" 2>&1
+rc=$?
+expect "main -M: empty saved state is rebuilt" 0 "Rebuilding"
+
+# getstock, against a stand-in for the price API that throttles and fails (tests/server.py)
+if command -v python3 > /dev/null; then
+	mkdir "$T/api"
+	for t in OK FLAKY RETRY TRUNC DOWN GZIP; do
+		gen_csv "$T/api/$t.csv" 2018-01-02 40 3
+	done
+	gen_csv "$T/api/BIG.csv" 2018-01-02 200 4
+	python3 "$SRC/server.py" "$T/api" 3 > "$T/port" 2>> "$T/log" &   # >>: the tests empty it
+	srv=$!
+	for i in $(seq 50); do
+		[ -s "$T/port" ] && break
+		sleep 0.1
+	done
+	url="http://127.0.0.1:$(cat "$T/port")/"
+	echo key > "$T/key"
+	get() { "$BIN/getstock" -k "$T/key" -u "$url" -b 2018-01-02 -e 2018-02-26 -r 3 "$@"; }
+
+	get -R 6 -o "$T/db" -- OK FLAKY RETRY TRUNC NOPE > "$T/out" 2>&1
+	rc=$?
+	n=0
+	for t in OK FLAKY RETRY TRUNC; do
+		cmp -s "$T/api/$t.csv" "$T/db/$t.2018-01-02.2018-02-26.csv" && n=$((n + 1))
+	done
+	if [ $rc -eq 0 ] && [ $n -eq 4 ]; then
+		pass "getstock: retries throttled, failed and cut off downloads"
+	else
+		fail "getstock: retries throttled, failed and cut off downloads (rc=$rc, $n of 4 files)"
+		sed 's/^/    /' "$T/out"
+	fi
+	if grep -q throttle "$T/log"; then
+		pass "getstock: the server throttled"
+	else
+		fail "getstock: the server throttled"
+	fi
+	get -R 1 -o "$T/db" -- DOWN > "$T/out" 2>&1
+	rc=$?
+	expect "getstock: gives up on a server that stays down" 0 "Failed to download DOWN"
+	if ! [ -d "$T/db" ] || ls "$T/db" | grep -q -e '^DOWN' -e '^NOPE' -e '\.tmp$'; then
+		fail "getstock: failed downloads leave no file"
+		ls "$T/db" | sed 's/^/    /'
+	else
+		pass "getstock: failed downloads leave no file"
+	fi
+
+	# the server only answers GZIP to a request that accepts gzip: getstock asks for it, and decodes it
+	get -R 6 -o "$T/db" -- GZIP > "$T/out" 2>&1
+	rc=$?
+	if [ $rc -eq 0 ] && cmp -s "$T/api/GZIP.csv" "$T/db/GZIP.2018-01-02.2018-02-26.csv"; then
+		pass "getstock: downloads compressed responses"
+	else
+		fail "getstock: downloads compressed responses (rc=$rc)"
+		sed 's/^/    /' "$T/out"
+	fi
+
+	# the catalog: an unchanged file is reused, a changed one is downloaded again
+	: > "$T/log"
+	get -R 6 -o "$T/db" -- OK FLAKY > "$T/out" 2>&1
+	rc=$?
+	if [ $rc -eq 0 ] && ! [ -s "$T/log" ]; then
+		pass "getstock: catalogued files are reused"
+	else
+		fail "getstock: catalogued files are reused (rc=$rc)"
+		sed 's/^/    /' "$T/log"
+	fi
+	sed -i '3s/,1000$/,1001/' "$T/db/OK.2018-01-02.2018-02-26.csv"
+	get -R 6 -o "$T/db" -- OK FLAKY > "$T/out" 2>&1
+	rc=$?
+	expect "getstock: a changed file is downloaded again" 0 "OK.2018-01-02.2018-02-26.csv has changed"
+	if cmp -s "$T/api/OK.csv" "$T/db/OK.2018-01-02.2018-02-26.csv" && [ "$(grep ' ok$' "$T/log")" = "OK ok" ]; then
+		pass "getstock: only the changed file is downloaded again"
+	else
+		fail "getstock: only the changed file is downloaded again"
+		sed 's/^/    /' "$T/log"
+	fi
+
+	# a catalogued file is extended by the dates missing from it, all of them if its prices were restated
+	# rows FILE BEGIN END: the header of FILE and its rows from BEGIN to END, as the server sends them
+	rows() { awk -F, -v b="$2" -v e="$3" 'NR == 1 || ($1 >= b && $1 <= e)' "$1"; }
+	gen_csv "$T/api/EXT.csv" 2018-01-02 80 5
+	get -R 6 -b 2018-01-15 -e 2018-02-15 -o "$T/db" -- EXT > "$T/out" 2>&1
+	rc=$?
+	if [ $rc -eq 0 ] && rows "$T/api/EXT.csv" 2018-01-15 2018-02-15 | cmp -s - "$T/db/EXT.2018-01-15.2018-02-15.csv"; then
+		pass "getstock: downloads the dates asked for"
+	else
+		fail "getstock: downloads the dates asked for (rc=$rc)"
+		sed 's/^/    /' "$T/out"
+	fi
+	: > "$T/log"
+	get -R 6 -b 2018-01-02 -e 2018-03-15 -o "$T/db" -- EXT > "$T/out" 2>&1
+	rc=$?
+	if [ $rc -eq 0 ] && rows "$T/api/EXT.csv" 2018-01-02 2018-03-15 | cmp -s - "$T/db/EXT.2018-01-02.2018-03-15.csv" &&
+	   [ "$(ls "$T/db" | grep -c '^EXT')" -eq 1 ] && [ "$(grep -c '^EXT ok$' "$T/log")" -eq 2 ]; then
+		pass "getstock: an extended file downloads the dates before and after it"
+	else
+		fail "getstock: an extended file downloads the dates before and after it (rc=$rc)"
+		sed 's/^/    /' "$T/out" "$T/log"
+		ls "$T/db" | sed 's/^/    /'
+	fi
+	# a 2:1 split, to 2018-03-20: every earlier price is halved, the cached ones too
+	awk -F, -v OFS=, 'NR > 1 && $1 <= "2018-03-20" { $2 = sprintf("%.4f", $2 / 2) } 1' "$T/api/EXT.csv" > "$T/split"
+	mv "$T/split" "$T/api/EXT.csv"
+	: > "$T/log"
+	get -R 6 -b 2018-01-02 -e 2018-04-02 -o "$T/db" -- EXT > "$T/out" 2>&1
+	rc=$?
+	expect "getstock: notices restated prices" 0 "Prices of EXT differ"
+	if [ $rc -eq 0 ] && rows "$T/api/EXT.csv" 2018-01-02 2018-04-02 | cmp -s - "$T/db/EXT.2018-01-02.2018-04-02.csv" &&
+	   [ "$(ls "$T/db" | grep -c '^EXT')" -eq 1 ]; then
+		pass "getstock: restated prices are downloaded again in full"
+	else
+		fail "getstock: restated prices are downloaded again in full (rc=$rc)"
+		ls "$T/db" | sed 's/^/    /'
+	fi
+	: > "$T/log"
+	get -R 6 -b 2018-01-02 -e 2018-04-02 -o "$T/db" -- EXT > "$T/out" 2>&1
+	rc=$?
+	if [ $rc -eq 0 ] && ! [ -s "$T/log" ]; then
+		pass "getstock: the file downloaded again is catalogued"
+	else
+		fail "getstock: the file downloaded again is catalogued (rc=$rc)"
+		sed 's/^/    /' "$T/log"
+	fi
+
+	# a file that cannot be written in full is a failure, not a short file
+	(trap '' XFSZ; ulimit -f 2; get -R 6 -e 2018-12-31 -o "$T/small" -- BIG OK) > "$T/out" 2>&1
+	rc=$?
+	expect "getstock: a short write fails the download" 0 "Failed to .*BIG"
+	if ! [ -d "$T/small" ] || [ -e "$T/small/BIG.2018-01-02.2018-12-31.csv" ] || ls "$T/small" | grep -q '\.tmp$'; then
+		fail "getstock: a short write leaves no file"
+		ls "$T/small" | sed 's/^/    /'
+	else
+		pass "getstock: a short write leaves no file"
+	fi
+else
+	echo "SKIP getstock: no python3"
+fi
+
+exit $failed
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# Portfolio Optimization Project
+# Synopsis: a stand-in for the price API, that throttles and fails like one, for tests/run.sh
+#
+# usage: tests/server.py DATADIR [LIMIT]
+#
+# Serves DATADIR/TICKER.csv as /TICKER.csv, on a free port of 127.0.0.1 that it prints
+# first: the rows from start_date to end_date, if the query has them, as the API does.
+# Past LIMIT requests a second (default 3) it answers 429. Some tickers fail
+# their first tries:
+#   FLAKY  500, twice
+#   RETRY  429 with Retry-After: 1, once
+#   TRUNC  a body cut off halfway, twice
+#   DOWN   503, always
+#   GZIP   406, unless the request accepts gzip
+# Bodies are gzipped for requests that accept it.
+# Every request is logged to stderr as "TICKER ACTION".
+import collections
+import gzip
+import os
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+PLAN = {
+    'FLAKY': ['500', '500'],
+    'RETRY': ['retry-after'],
+    'TRUNC': ['truncate', 'truncate'],
+}
+
+lock = threading.Lock()
+recent = collections.deque()   # times of the requests of the last second
+tries = collections.Counter()
+
+
+def rows(body, start, end):
+    """the header of the CSV data 'body', and its rows from 'start' to 'end' (YYYY-mm-dd)"""
+    lines = body.split(b'\n')
+    fields = [f.strip(b' "') for f in lines[0].rstrip(b'\r').split(b',')]
+    date = fields.index(b'Date')
+    out = [lines[0]]
+    for line in lines[1:]:
+        if not line:
+            continue
+        day = line.split(b',')[date].decode()
+        if (not start or day >= start) and (not end or day <= end):
+            out.append(line)
+    return b'\n'.join(out) + b'\n'
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, *args):
+        pass
+
+    def empty(self, code, headers=()):
+        self.send_response(code)
+        for k, v in headers:
+            self.send_header(k, v)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        ticker = os.path.basename(url.path).split('.')[0].upper()
+        query = parse_qs(url.query)
+        gzipped = 'gzip' in self.headers.get('Accept-Encoding', '')
+        now = time.time()
+        with lock:
+            while recent and recent[0] < now - 1:
+                recent.popleft()
+            throttled = len(recent) >= LIMIT
+            recent.append(now)
+            plan = PLAN.get(ticker, [])
+            n = tries[ticker]
+            tries[ticker] += 1
+            if throttled:
+                action = 'throttle'
+            elif ticker == 'DOWN':
+                action = '503'
+            elif ticker == 'GZIP' and not gzipped:
+                action = '406'
+            else:
+                action = plan[n] if n < len(plan) else 'ok'
+            sys.stderr.write('%s %s\n' % (ticker, action))
+            sys.stderr.flush()
+        if action == 'throttle':
+            return self.empty(429)
+        if action == 'retry-after':
+            return self.empty(429, [('Retry-After', '1')])
+        if action in ('406', '500', '503'):
+            return self.empty(int(action))
+        path = os.path.join(DATADIR, ticker + '.csv')
+        if not os.path.exists(path):
+            return self.empty(404)
+        with open(path, 'rb') as f:
+            body = f.read()
+        body = rows(body, query.get('start_date', [''])[0], query.get('end_date', [''])[0])
+        self.send_response(200)
+        if gzipped:
+            body = gzip.compress(body)
+            self.send_header('Content-Encoding', 'gzip')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        if action == 'truncate':
+            self.wfile.write(body[:len(body) // 2])
+            self.wfile.flush()
+            self.close_connection = True
+            return
+        self.wfile.write(body)
+
+
+if len(sys.argv) < 2:
+    sys.exit('usage: %s DATADIR [LIMIT]' % sys.argv[0])
+DATADIR = sys.argv[1]
+LIMIT = float(sys.argv[2]) if len(sys.argv) > 2 else 3
+server = ThreadingHTTPServer(('127.0.0.1', 0), Handler)
+print(server.server_address[1], flush=True)
+server.serve_forever()
@@ -0,0 +1,542 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Tests of libportfolio, run by 'make check'
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <omp.h>
+
+#include <Eigen/Core>
+#include <curl/curl.h>
+
+#include "portfolio.h"
+
+using namespace std;
+using namespace Eigen;
+
+static int failed;
+static char tmpdir[] = "/tmp/test_lib.XXXXXX";  /* for the files the tests write */
+static vector<string> written;
+
+/* write 'text' to tmpdir/name, and return its path */
+static string write_file(char const *name, char const *text)
+{
+	string path = string(tmpdir) + "/" + name;
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f) {
+		perror(path.c_str());
+		exit(1);
+	}
+	fputs(text, f);
+	fclose(f);
+	written.push_back(path);
+	return path;
+}
+
+#define CHECK(name, cond) \
+do { \
+	if (cond) { \
+		printf("PASS %s\n", name); \
+	} else { \
+		printf("FAIL %s (%s:%d: %s)\n", name, __FILE__, __LINE__, #cond); \
+		failed = 1; \
+	} \
+} while (0)
+
+/* every price move is in one week, the one from a Friday to the next Monday too */
+static void test_weekly_returns(void)
+{
+	double const p[11] = { 1, 1, 1, 1, 1,   2, 2, 2, 2, 2,   4 };
+	double r[2];
+
+	weeklyReturns(p, 11, r);
+	CHECK("weeklyReturns: first week starts at its first price", r[0] == 0.0);
+	CHECK("weeklyReturns: Friday to Monday move is kept", r[1] == 1.0);
+}
+
+/*
+ * qp_solve with fewer weeks than securities, where the covariance matrix is
+ * singular: the solution must meet the return constraint, and have no more
+ * variance than any of a large sample of random feasible portfolios
+ */
+static void test_qp_rank_deficient(void)
+{
+	int worst_rc = 0;
+	double worst_ret = 0, worst_var = 0;
+
+	srand48(4300);
+	for (int trial = 0; trial < 300; trial++) {
+		int k = 3 + trial % 6;
+		int T = k - 1;
+		MatrixXd R(T, k);
+		for (int i = 0; i < T; i++)
+			for (int j = 0; j < k; j++)
+				R(i, j) = 0.02 * (drand48() - 0.5) + 0.005 * j / k;
+		cov_model cv;
+		cv.factors = 0;
+		cv.C = cov(R);
+		VectorXd mu = R.colwise().mean();
+		double r = 0.6 * mu.maxCoeff() + 0.4 * mu.mean();
+		VectorXd w;
+		int rc = qp_solve(cv, mu, r + 1, 1.0, &w);  /* (mu.w + 1) * 1 >= r + 1 */
+		if (rc != 0) {
+			worst_rc = rc;
+			continue;
+		}
+		worst_ret = MIN(worst_ret, (mu.dot(w) - r) / fabs(r));
+		double var = cov_quad(cv, w);
+		/* random portfolios on the simplex that meet the constraint */
+		VectorXd x(k);
+		for (int n = 0; n < 20000; n++) {
+			for (int j = 0; j < k; j++)
+				x[j] = -log(drand48());
+			x /= x.sum();
+			if (mu.dot(x) >= r)
+				worst_var = MAX(worst_var, (var - cov_quad(cv, x)) / cv.C.diagonal().mean());
+		}
+	}
+	printf("     qp_solve, T = k - 1: rc %d, return off by %.2g, variance above random by %.2g of the mean variance\n",
+	       worst_rc, worst_ret, worst_var);
+	CHECK("qp_solve: T < k converges", worst_rc == 0);
+	CHECK("qp_solve: T < k meets the return constraint", worst_ret >= -1e-12);
+	CHECK("qp_solve: T < k is no worse than random portfolios", worst_var <= 1e-9);
+}
+
+/*
+ * run() in single precision: the portfolio it chooses must have its variance
+ * recomputed in double, and no other variance may be less
+ */
+static void test_run_float(void)
+{
+	int T = 60, k = 20;
+	MatrixXd R(T, k);
+	cov_model cv;
+	sim_options opts;
+	vector<VectorXd> weights;
+	vector<double> variances, returns;
+
+	sim_options_init(&opts);
+	CHECK("sim_options_init: simulates DEFAULT_NSIM portfolios, DEFAULT_BLOCK at a time",
+	      opts.nsim == DEFAULT_NSIM && opts.block == DEFAULT_BLOCK);
+	opts.nsim = 20000;
+	opts.seed = 7;
+	opts.sampler = SAMPLE_DIRICHLET;
+	opts.precision = PRECISION_FLOAT;
+	srand48(4301);
+	for (int i = 0; i < T; i++)
+		for (int j = 0; j < k; j++)
+			R(i, j) = 0.04 * (drand48() - 0.5);
+	moments m;
+	moments_init(&m, R);
+	cv.factors = 0;
+	cv.C = moments_cov(m);
+	int i = run(R, cv, m.mean, opts, 0, 1.0, &weights, &variances, &returns);
+	CHECK("run, float: a portfolio is chosen", i >= 0);
+	if (i < 0)
+		return;
+	CHECK("run, float: the chosen variance is a double one", variances[i] == cov_quad(cv, weights[i]));
+	bool least = true;
+	for (double v : variances)
+		least = least && variances[i] <= v;
+	CHECK("run, float: the chosen variance is the least", least);
+}
+
+/* the library reports a file it cannot read to its caller, and does not exit */
+/*
+ * run() gives the same portfolios for any number of threads: each block of them is
+ * drawn from its own counters, whichever thread runs it
+ */
+static void test_run_threads(void)
+{
+	int T = 60, k = 10;
+	MatrixXd R(T, k);
+	cov_model cv;
+	sim_options opts;
+
+	srand48(4304);
+	for (int i = 0; i < T; i++)
+		for (int j = 0; j < k; j++)
+			R(i, j) = 0.04 * (drand48() - 0.5) + 0.001 * j;
+	moments m;
+	moments_init(&m, R);
+	cv.factors = 0;
+	cv.C = moments_cov(m);
+	sim_options_init(&opts);
+	opts.nsim = 20000;
+	opts.seed = 11;
+	opts.sampler = SAMPLE_DIRICHLET;
+	int threads = omp_get_max_threads();
+	for (int topk = 0; topk <= 50; topk += 50) {
+		vector<VectorXd> weights[2];
+		vector<double> variances[2], returns[2];
+		int best[2];
+		opts.topk = topk;
+		for (int t = 0; t < 2; t++) {
+			omp_set_num_threads(t == 0 ? 1 : 4);
+			best[t] = run(R, cv, m.mean, opts, 0, 1.0, &weights[t], &variances[t], &returns[t]);
+		}
+		omp_set_num_threads(threads);
+		/* the threads hand in their portfolios in any order */
+		sort(variances[0].begin(), variances[0].end());
+		sort(variances[1].begin(), variances[1].end());
+		CHECK(topk ? "run, -k: 1 and 4 threads keep the same portfolios" :
+		             "run: 1 and 4 threads simulate the same portfolios",
+		      best[0] >= 0 && best[1] >= 0 && variances[0] == variances[1]);
+		CHECK(topk ? "run, -k: 1 and 4 threads choose the same portfolio" :
+		             "run: 1 and 4 threads choose the same portfolio",
+		      best[0] >= 0 && best[1] >= 0 && weights[0][best[0]] == weights[1][best[1]] &&
+		      returns[0][best[0]] == returns[1][best[1]]);
+	}
+}
+
+/*
+ * a security the solution gives no weight is dropped: the portfolio without it has the
+ * same variance, but for rounding, and optimize() takes the one with fewer securities
+ */
+static void test_optimize_tie(void)
+{
+	int T = 60, k = 6;
+	MatrixXd R(T, k);
+	cov_model cv;
+	sim_options opts;
+	vector<string> tickers;
+
+	srand48(4305);
+	for (int j = 0; j < k; j++) {
+		tickers.push_back(string(1, 'A' + j));
+		for (int i = 0; i < T; i++)
+			R(i, j) = 0.04 * (drand48() - 0.5) + 0.002;
+	}
+	/* Z is A, three times over: a long only portfolio has none of it */
+	tickers[k - 1] = "Z";
+	for (int i = 0; i < T; i++)
+		R(i, k - 1) = 3 * R(i, 0) + 0.001 * (drand48() - 0.5);
+	moments m;
+	moments_init(&m, R);
+	cv.factors = 0;
+	cv.C = moments_cov(m);
+	sim_options_init(&opts);
+	opts.engine = ENGINE_QP;
+	portfolio best = optimize(R, cv, m.mean, tickers, 100000.0, 0.0, 0.0, opts, NULL);
+	bool all_held = best.nstocks > 0;
+	for (int j = 0; j < best.nstocks; j++)
+		all_held = all_held && best.weights[j] > 0 && best.tickers[j] != "Z";
+	CHECK("optimize: a tie in variance goes to the portfolio with fewer stocks",
+	      best.nstocks == k - 1 && all_held);
+}
+
+/* the AVX2 simplex kernel draws the weights of the scalar one, bit for bit */
+static void test_simplex_avx2(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (!__builtin_cpu_supports("avx2")) {
+		printf("SKIP simplex_block: no AVX2\n");
+		return;
+	}
+	int ok = 1;
+	for (int sampler = SAMPLE_UNIFORM; sampler <= SAMPLE_DIRICHLET; sampler++) {
+		for (int n : { 1, 3, 4, 5, 8, 13, 31 }) {
+			for (int nb : { 1, 3, 8, 37 }) {
+				/* a first portfolio whose counter carries into its high word */
+				uint64_t first = (1ULL << 32) - 5;
+				vector<double> a((size_t) n * nb), b((size_t) n * nb);
+				simplex_block(0x123456789abcdefULL, n, first, nb, n, sampler, a.data());
+				simplex_block_scalar(0x123456789abcdefULL, n, first, nb, n, sampler, b.data());
+				ok = ok && memcmp(a.data(), b.data(), a.size() * sizeof a[0]) == 0;
+			}
+		}
+	}
+	CHECK("simplex_block: the AVX2 kernel matches the scalar one", ok);
+#else
+	printf("SKIP simplex_block: not x86\n");
+#endif
+}
+
+static void test_read_missing(void)
+{
+	vector<string> files = { "/nonexistent/AAA.csv" };
+	price_panel panel = read_stock_data(files, 17532, 17683);
+	CHECK("read_stock_data: a missing file sets the error", !panel.error.empty());
+	panel = read_store_data("/nonexistent.store", files, 17532, 17683);
+	CHECK("read_store_data: a missing store sets the error", !panel.error.empty());
+}
+
+/* "Adj. Close" is used over "Close" wherever it is in the header, the last column too */
+static void test_read_adj_close_last(void)
+{
+	vector<string> files = { write_file("ADJ.csv",
+		"Date,Open,Close,Adj. Close\n"
+		"2018-01-02,1,20,10\n"
+		"2018-01-03,1,22,11\n"
+		"2018-01-04,1,24,12\n"
+		"2018-01-05,1,26,13\n"
+		"2018-01-08,1,28,14\n"
+		"2018-01-09,1,30,15\n") };
+	price_panel panel = read_stock_data(files, 17532, 17683);
+	CHECK("read_stock_data: reads the file with Adj. Close last",
+	      panel.error.empty() && panel.prices.rows() == 6 && panel.prices.cols() == 1);
+	CHECK("read_stock_data: takes Adj. Close, in the last column, over Close",
+	      panel.prices.rows() == 6 && panel.prices(0, 0) == 10 && panel.prices(5, 0) == 15);
+}
+
+/* three tickers with gaps, extra rows, a row out of order and their columns in any order */
+static vector<string> write_fixtures(void)
+{
+	return {
+		write_file("AAA.csv",
+			"Date,Open,Close\n"
+			"2018-01-01,1,10.0\n"
+			"2018-01-02,1,10.5\n"
+			"2018-01-03,1,10.25\n"
+			"2018-01-04,1,11.0\n"
+			"2018-01-05,1,10.75\n"
+			"2018-01-08,1,11.5\n"
+			"2018-01-09,1,11.25\n"
+			"2018-01-10,1,12.0\n"
+			"2018-01-11,1,11.75\n"
+			"2018-01-12,1,12.5\n"),
+		write_file("BBB.csv",
+			"Date,Close,Adj. Close\r\n"
+			"2018-01-02,40,20.0\r\n"
+			"2018-01-03,42,21.0\r\n"
+			"2018-01-05,44,22.0\r\n"
+			"2018-01-04,46,23.0\r\n"
+			"2018-01-08,48,24.0\r\n"
+			"2018-01-09,50,25.0\r\n"
+			"2018-01-10,52,26.0\r\n"
+			"2018-01-11,54,27.0\r\n"),
+		write_file("CCC.csv",
+			"\"Adj. Close\",\"Date\"\n"
+			"30.5,2018-01-03\n"
+			"31.5,2018-01-04\n"
+			"32.5,2018-01-05\n"
+			"33.5,2018-01-08\n"
+			"34.5,2018-01-09\n"
+			"35.5,2018-01-10\n"
+			"36.5,2018-01-11\n"),
+	};
+}
+
+/* a store built from CSV files gives main the panel the files do */
+static void test_store_matches_csv(void)
+{
+	vector<string> files = write_fixtures();
+	vector<store_series> all;
+	for (auto & f : files) {
+		csv_parser p;
+		store_series s;
+		s.ticker = ticker_from_filename(f.c_str());
+		csv_read_file(f.c_str(), &p, &s);
+		all.push_back(s);
+	}
+	int32_t start = 17533, end = 17542;  /* 2018-01-02 to 2018-01-11 */
+	price_panel csv = read_stock_data(files, start, end);
+	CHECK("read_stock_data: reads the fixtures, gaps and all",
+	      csv.error.empty() && csv.tickers.size() == 3 && csv.dates.size() == 8 &&
+	      csv.mask.minCoeff() == 0);
+	for (int compress = 0; compress <= 1; compress++) {
+		string store = string(tmpdir) + (compress ? "/prices.z.store" : "/prices.store");
+		CHECK(compress ? "store_write: writes a compressed store of the fixtures" :
+		                 "store_write: writes a store of the fixtures",
+		      store_write(store.c_str(), all, compress) == 0);
+		written.push_back(store);
+		price_panel st = read_store_data(store.c_str(), files, start, end);
+		CHECK("read_store_data: reads the fixtures", st.error.empty());
+		CHECK("read_store_data: the dates and tickers of read_stock_data",
+		      st.dates == csv.dates && st.tickers == csv.tickers);
+		CHECK("read_store_data: the prices and mask of read_stock_data",
+		      st.prices.rows() == csv.prices.rows() && st.prices.cols() == csv.prices.cols() &&
+		      st.prices == csv.prices && st.mask == csv.mask);
+	}
+}
+
+/*
+ * a compressed store reads back as the plain one does, bit for bit: the decimal
+ * columns, with and without gaps, and one that is not decimal at all
+ */
+static void test_store_compressed(void)
+{
+	vector<store_series> all(3);
+	all[0].ticker = "DEC";
+	all[1].ticker = "GAP";
+	all[2].ticker = "RAW";
+	for (int i = 0; i < 300; i++) {
+		int32_t day = 17532 + i;
+		all[0].dates.push_back(day);
+		all[0].prices.push_back(100 + 0.01 * ((i * 37) % 101) - 0.25 * (i % 7));
+		if (i % 5 != 3) {
+			all[1].dates.push_back(day);
+			all[1].prices.push_back(1234.5 - 0.125 * i);
+		}
+		all[2].dates.push_back(day);
+		all[2].prices.push_back(100.0 / (i + 3));
+	}
+	string plain = string(tmpdir) + "/plain.store", packed = string(tmpdir) + "/packed.store";
+	int wrote = store_write(plain.c_str(), all, 0) == 0 && store_write(packed.c_str(), all, 1) == 0;
+	written.push_back(plain);
+	written.push_back(packed);
+	price_store a, b;
+	int opened = wrote && store_open(plain.c_str(), &a) == 0;
+	opened = opened && store_open(packed.c_str(), &b) == 0;
+	CHECK("store_write: writes and opens a compressed store", opened);
+	if (!opened)
+		return;
+	size_t nd = a.ndates, nt = a.ntickers;
+	CHECK("store_open: a compressed store has the dates and tickers of a plain one",
+	      b.ndates == a.ndates && b.ntickers == a.ntickers &&
+	      memcmp(a.dates, b.dates, nd * sizeof *a.dates) == 0 &&
+	      memcmp(a.tickers, b.tickers, nt * STORE_TICKER_LEN) == 0);
+	CHECK("store_open: a compressed store has the prices of a plain one, NaNs and all",
+	      b.ndates == a.ndates && b.ntickers == a.ntickers &&
+	      memcmp(a.prices, b.prices, nt * nd * sizeof *a.prices) == 0);
+	struct stat sa, sb;
+	CHECK("store_write: a compressed store is smaller",
+	      stat(plain.c_str(), &sa) == 0 && stat(packed.c_str(), &sb) == 0 && sb.st_size < sa.st_size);
+	store_close(&a);
+	store_close(&b);
+}
+
+/* parse 'text' with csv_feed(), in chunks that end at each offset in 'cuts' */
+static void parse_chunks(string const & text, vector<size_t> const & cuts, csv_parser *p, store_series *s)
+{
+	size_t from = 0;
+	*s = store_series();
+	csv_init(p, s);
+	for (size_t to : cuts) {
+		csv_feed(p, text.data() + from, to - from);
+		from = to;
+	}
+	csv_feed(p, text.data() + from, text.size() - from);
+	csv_finish(p);
+}
+
+static int same_parse(csv_parser const & a, store_series const & sa, csv_parser const & b, store_series const & sb)
+{
+	return a.header == b.header && a.date_index == b.date_index && a.close_index == b.close_index &&
+	       a.skipped == b.skipped && a.unordered == b.unordered &&
+	       sa.dates == sb.dates && sa.prices == sb.prices;
+}
+
+/*
+ * csv_feed() parses data that arrives in pieces as it does the whole of it, wherever
+ * the pieces end: in a quoted header, in a field, between a '\r' and its '\n'
+ */
+static void test_csv_chunks(void)
+{
+	string text =
+		"\"Date\",\"Open\",\"Close\",\"Adj. Close\"\r\n"
+		"2018-01-02,1,40,20.5\r\n"
+		"2018-01-03,1,42,21.25\r\n"
+		"2018-01-05,1,44,x\r\n"
+		"2018-01-08,1,48,24.125\r\n"
+		"2018-01-04,1,46,23\r\n"
+		"\r\n"
+		"2018-01-09,1,50,25";
+	csv_parser whole, p;
+	store_series sw, s;
+	parse_chunks(text, {}, &whole, &sw);
+	CHECK("csv_feed: parses the whole buffer",
+	      whole.date_index == 0 && whole.close_index == 3 && whole.skipped == 1 &&
+	      whole.unordered == 1 && sw.dates.size() == 4 && sw.prices.back() == 25);
+
+	int ok = 1;
+	for (size_t i = 0; i <= text.size(); i++) {
+		for (size_t j = i; j <= text.size(); j++) {
+			parse_chunks(text, {i, j}, &p, &s);
+			ok = ok && same_parse(p, s, whole, sw);
+		}
+	}
+	CHECK("csv_feed: three chunks, split anywhere, parse as the whole buffer does", ok);
+	vector<size_t> bytes;
+	for (size_t i = 1; i < text.size(); i++)
+		bytes.push_back(i);
+	parse_chunks(text, bytes, &p, &s);
+	CHECK("csv_feed: a byte at a time parses as the whole buffer does", same_parse(p, s, whole, sw));
+}
+
+/*
+ * optimize() with a warm start, as main's -f loop runs it: the first call saves its
+ * first solution, and the next one, from there, finds what a cold start does
+ */
+static void test_optimize_warm(void)
+{
+	int T = 60, k = 12;
+	MatrixXd R(T, k);
+	cov_model cv;
+	sim_options opts;
+	vector<string> tickers;
+	VectorXd warm;
+
+	srand48(4302);
+	for (int j = 0; j < k; j++) {
+		tickers.push_back(string(1, 'A' + j));
+		for (int i = 0; i < T; i++)
+			R(i, j) = 0.04 * (drand48() - 0.5) + 0.004 * j / k;
+	}
+	moments m;
+	moments_init(&m, R);
+	cv.factors = 0;
+	cv.C = moments_cov(m);
+	sim_options_init(&opts);
+	opts.engine = ENGINE_QP;
+	optimize(R, cv, m.mean, tickers, 100000.0, 0.003, 10.0, opts, &warm);
+	CHECK("optimize: the first solve is saved as the warm start", warm.size() == k);
+	portfolio hot = optimize(R, cv, m.mean, tickers, 100000.0, 0.002, 10.0, opts, &warm);
+	portfolio cold = optimize(R, cv, m.mean, tickers, 100000.0, 0.002, 10.0, opts, NULL);
+	CHECK("optimize: a warm start finds the portfolio of a cold one",
+	      cold.nstocks != -1 && hot.nstocks == cold.nstocks && hot.tickers == cold.tickers &&
+	      fabs(hot.variance - cold.variance) <= 1e-9 * cold.variance);
+}
+
+/* download_all() draws its retry delays from a stream of its own, not the caller's drand48() */
+static void test_download_rng(void)
+{
+	vector<fetch> none;
+
+	srand48(4303);
+	double a = drand48();
+	srand48(4303);
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	download_all(none, 1, 0, 0, NULL);
+	curl_global_cleanup();
+	CHECK("download_all: leaves drand48() alone", drand48() == a);
+}
+
+int main()
+{
+	if (!mkdtemp(tmpdir)) {
+		perror(tmpdir);
+		return 1;
+	}
+	test_weekly_returns();
+	test_qp_rank_deficient();
+	test_run_float();
+	test_run_threads();
+	test_simplex_avx2();
+	test_read_missing();
+	test_read_adj_close_last();
+	test_store_matches_csv();
+	test_store_compressed();
+	test_csv_chunks();
+	test_optimize_warm();
+	test_optimize_tie();
+	test_download_rng();
+	for (auto & path : written)
+		unlink(path.c_str());
+	rmdir(tmpdir);
+	return failed;
+}
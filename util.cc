@@ -0,0 +1,119 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Error reporting, string and date helpers shared by the library and the programs
+ */
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "pricestore.h"
+#include "util.h"
+
+using namespace std;
+
+FILE *warn_file = stderr;
+
+void die(char const *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stdout, fmt, args);
+	va_end(args);
+	exit(1);
+}
+
+void warn(char const *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(warn_file, fmt, args);
+	va_end(args);
+}
+
+string upper(char const *s)
+{
+	int size = (int) strlen(s);
+	string ret;
+	ret.resize(size);
+	for (int i = 0; i < size; i++) {
+		ret[i] = toupper(s[i]);
+	}
+	return ret;
+}
+
+/*
+ * Given a filename of the form
+ * path/to/TICKER.begin.end.csv
+ * return TICKER
+ */
+string ticker_from_filename(char const *filename)
+{
+	char const *base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+	return upper(string(base, strchrnul(base, '.')).c_str());
+}
+
+string slurp(string const & filename)
+{
+	ifstream file{filename};
+	if (!file.is_open()) {
+		return {};
+	}
+	stringstream ss;
+	ss << file.rdbuf();
+	return ss.str();
+}
+
+/* printf to the end of a string */
+void appendf(string *s, char const *fmt, ...)
+{
+	char buf[512];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof buf, fmt, args);
+	va_end(args);
+	s->append(buf);
+}
+
+/*
+ * Given a string of the form
+ * YYYY-mm-dd
+ * parse it and save it as an integral type (time_t), midnight UTC.
+ * Returns 0 if the string is not a valid date.
+ * Dates are compared as day keys (see parse_date in pricestore.h) everywhere
+ * in the library; this is kept for callers that want a time_t.
+ */
+time_t strtotime(char const *s)
+{
+	int32_t day;
+	if (!parse_date(s, &day))
+		return 0;
+	return (time_t) day * SECONDS_IN_DAY;
+}
+
+void timetostr(time_t t, char *s)
+{
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	strftime(s,64,DATE_FMT,&tm);
+}
@@ -0,0 +1,51 @@
+/*
+ * Portfolio Optimization Project
+ * Authors:
+ *   Gabriel Etrata
+ *   Liming Kang
+ *   Tom Maltese
+ *   Pav Singh
+ *   Zeqi Wang
+ * URL: https://github.com/tommalt/m4300-project
+ * Synopsis: Error reporting, string and date helpers shared by the library and the programs
+ */
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+
+/* DATE_FMT is the format of every date the programs read, write or put in a file name.
+ * Dates are compared as day keys, see parse_date in pricestore.h
+ */
+#define DATE_FMT "%Y-%m-%d"
+#define SECONDS_IN_DAY 86400
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+/* where warn() writes: stderr, unless the program wants its warnings with the rest
+ * of its output (main sets stdout). The library never writes to stdout itself */
+extern FILE *warn_file;
+
+/* print a message and exit(1) */
+void die(char const *fmt, ...);
+/* print a message to warn_file */
+void warn(char const *fmt, ...);
+
+std::string upper(char const *s);
+/* "path/to/TICKER.begin.end.csv" -> "TICKER" */
+std::string ticker_from_filename(char const *filename);
+/* the contents of a file, or "" if it cannot be read */
+std::string slurp(std::string const & filename);
+/* printf to the end of a string */
+void appendf(std::string *s, char const *fmt, ...);
+
+/* midnight UTC of a DATE_FMT date, or 0 if it is not one */
+time_t strtotime(char const *s);
+/* write the DATE_FMT date of 't' to 's', which holds at least 64 characters */
+void timetostr(time_t t, char *s);
+
+#endif